@@ -650,6 +650,7 @@ int main(void)
 		}
 #endif
 		
+		itu_lib_render_debug_flush(context.renderer);
 		itu_lib_imgui_frame_end(&context);
 
 		SDL_GetCurrentTime(&walltime_work_end);
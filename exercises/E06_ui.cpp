@@ -28,12 +28,16 @@ enum EX6_Tags
 	TAG_ASTEROID
 };
 
+enum EX6_Relations
+{
+	REL_TARGETS,    // player -> closest asteroid
+	REL_DISPLAYS,   // health bar -> entity whose health is displayed
+};
+
 struct EX6_PlayerData
 {
 	float curr_speed_linear;
 	float curr_speed_rotational;
-
-	ITU_EntityId target;
 };
 register_component(EX6_PlayerData)
 
@@ -47,7 +51,6 @@ register_component(EX6_Health)
 struct EX6_HealthRenderer
 {
 	float widget_base_w;
-	ITU_EntityId target;
 };
 register_component(EX6_HealthRenderer)
 
@@ -185,8 +188,6 @@ void ex6_debug_ui_render_playerdata(SDLContext* context, void* data)
 
 	ImGui::DragFloat("curr. linear speed", &data_player->curr_speed_linear);
 	ImGui::DragFloat("curr. rotational speed", &data_player->curr_speed_rotational);
-
-	itu_debug_ui_widget_entityid("target", data_player->target);
 }
 
 void ex6_debug_ui_render_health(SDLContext* context, void* data)
@@ -201,7 +202,6 @@ void ex6_debug_ui_render_healthrenderer(SDLContext* context, void* data)
 {
 	EX6_HealthRenderer* data_renderer = (EX6_HealthRenderer*)data;
 
-	itu_debug_ui_widget_entityid("target", data_renderer->target);
 	ImGui::DragFloat("base widget width", &data_renderer->widget_base_w);
 }
 
@@ -234,6 +234,14 @@ void ex6_debug_ui_render_sprite9patch(SDLContext* context, void* data)
 	ImGui::ColorEdit4("tint", &data_sprite->tint.r);
 }
 
+// same as the standard Sprite fixup, the texture pointer has to be remapped when loading a world file
+bool ex6_load_fixup_sprite9patch(ITU_EntityId id, void* data)
+{
+	EX6_Sprite9Patch* data_sprite = (EX6_Sprite9Patch*)data;
+	data_sprite->texture = itu_sys_estorage_load_texture(data_sprite->texture);
+	return data_sprite->texture != NULL;
+}
+
 // ============================================================================================
 // 
 // ============================================================================================
@@ -242,6 +250,7 @@ struct GameState
 {
 	// SDL-allocated structures
 	SDL_Texture* atlas_space;
+	SDL_Texture* atlas_dungeon;
 	SDL_Texture* ui_healtbar;
 };
 
@@ -250,7 +259,6 @@ void ex6_system_assign_player_target(SDLContext* context, ITU_EntityId* entity_i
 	if(!itu_entity_is_valid(id_player))
 		return;
 
-	EX6_PlayerData* player_data = entity_get_data(id_player, EX6_PlayerData);
 	Transform* player_transform = entity_get_data(id_player, Transform);
 	vec2f player_pos = player_transform->position;
 
@@ -270,7 +278,10 @@ void ex6_system_assign_player_target(SDLContext* context, ITU_EntityId* entity_i
 		}
 	}
 
-	player_data->target = id_closest;
+	if(itu_entity_is_valid(id_closest))
+		itu_entity_relation_set(id_player, REL_TARGETS, id_closest);
+	else
+		itu_entity_relation_remove(id_player, REL_TARGETS);
 }
 
 void ex6_system_player_update(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count)
@@ -278,9 +289,8 @@ void ex6_system_player_update(SDLContext* context, ITU_EntityId* entity_ids, int
 	for(int i = 0; i < entity_ids_count; ++i)
 	{
 		ITU_EntityId id = entity_ids[i];
-		Transform*      transform    = entity_get_data(id, Transform);
-		EX6_PlayerData* data         = entity_get_data(id, EX6_PlayerData);
-		PhysicsData*    physics_data = entity_get_data(id, PhysicsData);
+		Transform*      transform    = entity_get_data_mut(id, Transform);
+		PhysicsData*    physics_data = entity_get_data_mut(id, PhysicsData);
 
 		vec2f dir = VEC2F_ZERO;
 		if(context->btn_isdown[BTN_TYPE_UP])
@@ -294,10 +304,12 @@ void ex6_system_player_update(SDLContext* context, ITU_EntityId* entity_ids, int
 
 		physics_data->velocity = normalize(dir) * 5;
 
+		// NOTE: the relation is removed automatically if the target gets destroyed
+		ITU_EntityId target = itu_entity_relation_get(id, REL_TARGETS);
 		float target_rotation = 0.0f;
-		if(itu_entity_is_valid(data->target))
+		if(itu_entity_is_valid(target))
 		{
-			Transform* target_transform = entity_get_data(data->target, Transform);
+			Transform* target_transform = entity_get_data(target, Transform);
 			vec2f lookat = normalize(target_transform->position - transform->position);
 			target_rotation = SDL_atan2f(lookat.y, lookat.x) - PI_HALF;
 		}
@@ -313,12 +325,13 @@ void ex6_system_health(SDLContext* context, ITU_EntityId* entity_ids, int entity
 	{
 		ITU_EntityId id = entity_ids[i];
 		EX6_HealthRenderer* renderer = entity_get_data(id, EX6_HealthRenderer);
+		ITU_EntityId target = itu_entity_relation_get(id, REL_DISPLAYS);
 
-		if(!itu_entity_is_valid(renderer->target))
+		if(!itu_entity_is_valid(target))
 			continue;
 
-		EX6_Sprite9Patch* sprite = entity_get_data(id, EX6_Sprite9Patch);
-		EX6_Health* health = entity_get_data(renderer->target, EX6_Health);
+		EX6_Sprite9Patch* sprite = entity_get_data_mut(id, EX6_Sprite9Patch);
+		EX6_Health* health = entity_get_data_mut(target, EX6_Health);
 
 		if(context->btn_isjustpressed[BTN_TYPE_SPACE])
 			health->curr = SDL_clamp(health->curr - health->max / 10, 0, 100);
@@ -331,14 +344,16 @@ static void game_init(SDLContext* context, GameState* state)
 {
 	// texture atlases
 	state->atlas_space = texture_create(context, "data/kenney/simpleSpace_tilesheet_2.png", SDL_SCALEMODE_LINEAR);
+	state->atlas_dungeon = texture_create(context, "data/kenney/tiny_dungeon_packed.png", SDL_SCALEMODE_NEAREST);
 	state->ui_healtbar = texture_create(context, "data/kenney/UI/bar_round_gloss_small_red.png", SDL_SCALEMODE_LINEAR);
 
-	itu_sys_estorage_init(512);
+	itu_sys_estorage_init(context, 512);
 	itu_sys_physics_init(context);
 
-	enable_component(EX6_PlayerData);
-	enable_component(EX6_Health);
-	enable_component(EX6_HealthRenderer);
+	// there is only one player (and one healthbar), no need to reserve space for more
+	enable_component_with_capacity(EX6_PlayerData, 1);
+	enable_component_with_capacity(EX6_Health, 1);
+	enable_component_with_capacity(EX6_HealthRenderer, 1);
 	enable_component(EX6_TransformScreen);
 	enable_component(EX6_Sprite9Patch);
 
@@ -348,13 +363,21 @@ static void game_init(SDLContext* context, GameState* state)
 	add_component_debug_ui_render(EX6_TransformScreen, ex6_debug_ui_render_transformscreen);
 	add_component_debug_ui_render(EX6_Sprite9Patch, ex6_debug_ui_render_sprite9patch);
 
+	add_component_load_fixup(EX6_Sprite9Patch, ex6_load_fixup_sprite9patch);
+
 	itu_sys_estorage_tag_set_debug_name(TAG_CAMERA_TARGET, "camera target");
 	itu_sys_estorage_tag_set_debug_name(TAG_ASTEROID, "asteroid");
+	itu_sys_estorage_relation_set_debug_name(REL_TARGETS, "targets");
+	itu_sys_estorage_relation_set_debug_name(REL_DISPLAYS, "displays");
 	
 	add_system(ex6_system_camera_target             , component_mask(Transform)                                             , tag_mask(TAG_CAMERA_TARGET));
-	add_system(ex6_system_assign_player_target      , component_mask(Transform)                                             , tag_mask(TAG_ASTEROID));
-	add_system(ex6_system_player_update             , component_mask(PhysicsData)         | component_mask(EX6_PlayerData)  , 0);
-	add_system(ex6_system_health                    , component_mask(EX6_HealthRenderer)  | component_mask(EX6_Sprite9Patch), 0);
+	// these only touch component data, so they can declare what they read/write and run in parallel when they don't conflict
+	add_system_rw(ex6_system_assign_player_target   , component_mask(Transform)                                             , tag_mask(TAG_ASTEROID)
+		, component_mask(Transform)                                                       , 0);
+	add_system_rw(ex6_system_player_update          , component_mask(PhysicsData)         | component_mask(EX6_PlayerData)  , 0
+		, component_mask(EX6_PlayerData)                                                  , component_mask(Transform) | component_mask(PhysicsData));
+	add_system_rw(ex6_system_health                 , component_mask(EX6_HealthRenderer)  | component_mask(EX6_Sprite9Patch), 0
+		, component_mask(EX6_HealthRenderer)                                              , component_mask(EX6_Sprite9Patch) | component_mask(EX6_Health));
 	add_system(ex6_system_sprite_render_camera      , component_mask(EX6_TransformScreen) | component_mask(Sprite)          , 0);
 	add_system(ex6_system_sprite9patch_render_camera, component_mask(EX6_TransformScreen) | component_mask(EX6_Sprite9Patch), 0);
 }
@@ -367,13 +390,55 @@ static void game_reset(SDLContext* context, GameState* state)
 	world_def.gravity.y = 0;
 	itu_sys_physics_reset(&world_def);
 
-	SDL_assert(ENTITY_COUNT <= ENTITIES_COUNT_MAX);
-
 	b2BodyDef body_def = b2DefaultBodyDef();
 	b2ShapeDef shape_def = b2DefaultShapeDef();
 	b2Circle circle = { 0 };
 	circle.radius = 0.25f;
 
+	// floor, a single tilemap entity instead of one sprite per tile (same tiles as the E03 room)
+	{
+		// NOTE: not a multiple of TILEMAP_CHUNK_SIZE, so the last row and column of chunks are only partially filled
+		const int map_size = 72;
+
+		ITU_EntityId id = itu_entity_create();
+		itu_entity_set_debug_name(id, "floor");
+		Transform transform = TRANSFORM_DEFAULT;
+		transform.scale = VEC2F_ONE * (TEXTURE_PIXELS_PER_UNIT / 16.0f); // tiles are 16px, make them one world unit
+		transform.position.x = -map_size / 2.0f;
+		transform.position.y = -map_size / 2.0f;
+
+		Tilemap tilemap;
+		itu_lib_tilemap_init(&tilemap, state->atlas_dungeon, 16, map_size, map_size);
+		for(int y = 0; y < map_size; ++y)
+		{
+			for(int x = 0; x < map_size; ++x)
+			{
+				bool left   = x == 0;
+				bool right  = x == map_size - 1;
+				bool bottom = y == 0;
+				bool top    = y == map_size - 1;
+
+				// NOTE: tilemap rows go up, so the first one is the bottom wall
+				Uint16 tile = 0;
+				if(top)
+					tile = left ? 1 : right ? 3 : 2;
+				else if(bottom)
+					tile = left ? 25 : right ? 27 : 26;
+				else if(left)
+					tile = 13;
+				else if(right)
+					tile = 15;
+				itu_lib_tilemap_set(&tilemap, x, y, tile);
+			}
+		}
+
+		TransformWorld transform_world = { 0 };
+
+		entity_add_component(id, Transform     , transform);
+		entity_add_component(id, TransformWorld, transform_world);
+		entity_add_component(id, Tilemap       , tilemap);
+	}
+
 	// player
 	{
 		id_player = itu_entity_create();
@@ -402,7 +467,10 @@ static void game_reset(SDLContext* context, GameState* state)
 		health.curr = 100;
 
 
+		TransformWorld transform_world = { 0 };
+
 		entity_add_component(id_player, Transform     , transform);
+		entity_add_component(id_player, TransformWorld, transform_world);
 		entity_add_component(id_player, Sprite        , sprite);
 		entity_add_component(id_player, EX6_PlayerData, data);
 		entity_add_component(id_player, PhysicsData   , physics_data);
@@ -438,7 +506,10 @@ static void game_reset(SDLContext* context, GameState* state)
 		ShapeData shape_data;
 		shape_data.shape_id = b2CreateCircleShape(physics_data.body_id, &shape_def, &circle);
 
+		TransformWorld transform_world = { 0 };
+
 		entity_add_component(id, Transform,   transform);
+		entity_add_component(id, TransformWorld, transform_world);
 		entity_add_component(id, Sprite,      sprite);
 		entity_add_component(id, PhysicsStaticData, physics_data);
 		entity_add_component(id, ShapeData, shape_data);
@@ -465,12 +536,12 @@ static void game_reset(SDLContext* context, GameState* state)
 		sprite.tint = COLOR_WHITE;
 
 		EX6_HealthRenderer renderer;
-		renderer.target = id_player;
 		renderer.widget_base_w = sprite.size.x;
 
 		entity_add_component(id, EX6_TransformScreen, transform);
 		entity_add_component(id, EX6_Sprite9Patch, sprite);
 		entity_add_component(id, EX6_HealthRenderer, renderer);
+		itu_entity_relation_set(id, REL_DISPLAYS, id_player);
 	}
 }
 
@@ -484,6 +555,10 @@ int main(void)
 	context.window_w = WINDOW_W;
 	context.window_h = WINDOW_H;
 
+	// preallocate scratch memory upfront, so that frames don't need to touch the heap
+	itu_lib_arena_init(&context.arena_frame, MB(1));
+	itu_lib_arena_init(&context.arena_level, MB(1));
+
 	window = SDL_CreateWindow("E06 - UI", WINDOW_W, WINDOW_H, 0);
 	context.renderer = SDL_CreateRenderer(window, "vulkan");
 	SDL_SetRenderDrawBlendMode(context.renderer, SDL_BLENDMODE_BLEND);
@@ -546,6 +621,17 @@ int main(void)
 			ImGui::LabelText("work", "%6.3f ms/f", (float)elapsed_work  / (float)MILLIS(1));
 			ImGui::LabelText("tot",  "%6.3f ms/f", (float)elapsed_frame / (float)MILLIS(1));
 			ImGui::LabelText("physics steps",  "%d", context.physics_steps_count);
+			ImGui::LabelText("sprite draws",   "%d", itu_lib_sprite_batch_get_draw_calls_count());
+			ImGui::LabelText("debug draws",    "%d", itu_lib_render_debug_get_draw_calls_count());
+			ImGui::Text("Memory");
+			ImGui::LabelText("frame arena", "%6.1f KB (peak)", (float)context.arena_frame.used_peak / (float)KB(1));
+			ImGui::LabelText("level arena", "%6.1f KB",        (float)itu_lib_arena_used(&context.arena_level) / (float)KB(1));
+			ImGui::Text("World");
+			if(ImGui::Button("save"))
+				itu_sys_estorage_save("E06_world.bin");
+			ImGui::SameLine();
+			if(ImGui::Button("load"))
+				itu_sys_estorage_load("E06_world.bin");
 
 			ImGui::End();
 
@@ -553,6 +639,7 @@ int main(void)
 		}
 #endif
 
+		itu_lib_render_debug_flush(context.renderer);
 		itu_lib_imgui_frame_end(&context);
 
 		SDL_GetCurrentTime(&walltime_work_end);
@@ -567,9 +654,13 @@ int main(void)
 		// render
 		SDL_RenderPresent(context.renderer);
 
+		itu_lib_arena_reset(&context.arena_frame);
+
 		context.delta = (float)elapsed_frame / (float)SECONDS(1);
 		context.uptime += context.delta;
 		context.elapsed_frame = elapsed_frame;
 		walltime_frame_beg = walltime_frame_end;
 	}
+
+	itu_sys_estorage_shutdown();
 }
@@ -314,6 +314,20 @@ inline color color_saturate(color c)
 	};
 }
 
+// *******************************************************************
+// sorting
+// *******************************************************************
+
+// maps a float to a key that sorts in the same order (ie, to sort by depth)
+inline Uint64 itu_sort_key_from_float(float value)
+{
+	Uint32 bits;
+	SDL_memcpy(&bits, &value, sizeof(bits));
+	// NOTE: flip all bits of negative numbers (they are sign-magnitude), only the sign bit of positive ones
+	bits ^= (bits & 0x80000000) ? 0xffffffff : 0x80000000;
+	return bits;
+}
+
 // *******************************************************************
 // easing functions
 // *******************************************************************
@@ -1,22 +1,243 @@
+// only sprites visible from the active camera are submitted (see `itu_sys_visibility.hpp`)
+// NOTE: to render more cameras, call `itu_sys_visibility_render_sprites()` for each of them after this
 void itu_system_sprite_render(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count)
 {
+	if(entity_ids_count == 0)
+		return;
+
+	itu_sys_visibility_update(context, entity_ids, entity_ids_count);
+	itu_sys_visibility_render_sprites(context, context->camera_active);
+}
+
+// NOTE: tilemaps are few and big, each one takes care of culling its own chunks
+void itu_system_tilemap_render(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count)
+{
+	ITU_View<TransformWorld, Tilemap> view;
+	view.each(entity_ids, entity_ids_count, [&](ITU_EntityId id, TransformWorld& transform_world, Tilemap& tilemap)
+	{
+		itu_lib_tilemap_render(context, &tilemap, &transform_world.transform);
+	});
+}
+
+// tiles and chunk textures are owned by the component
+void itu_observer_tilemap_on_remove(ITU_EntityId* entity_ids, void* components_data, int count)
+{
+	Tilemap* tilemaps = (Tilemap*)components_data;
+	for(int i = 0; i < count; ++i)
+		itu_lib_tilemap_destroy(&tilemaps[i]);
+}
+
+// a restored tilemap is only valid if it was not destroyed in the meantime (tiles are not part of snapshots)
+bool itu_load_fixup_tilemap(ITU_EntityId id, void* data)
+{
+	Tilemap* tilemap = (Tilemap*)data;
+	if(!itu_lib_tilemap_is_alive(tilemap))
+	{
+		SDL_zerop(tilemap);
+		return false;
+	}
+	tilemap->tileset = itu_sys_estorage_load_texture(tilemap->tileset);
+
+	// NOTE: chunks are live memory, the count saved with the component can be out of date
+	tilemap->chunks_resident_count = 0;
+	for(int i = 0; i < tilemap->chunks_w * tilemap->chunks_h; ++i)
+		if(tilemap->chunks[i].texture)
+			tilemap->chunks_resident_count++;
+	return true;
+}
+
+// textures are not owned by sprites, they only need to be remapped when loading world files
+bool itu_load_fixup_sprite(ITU_EntityId id, void* data)
+{
+	Sprite* sprite = (Sprite*)data;
+	if(!sprite->texture)
+		return true;
+
+	sprite->texture = itu_sys_estorage_load_texture(sprite->texture);
+	return sprite->texture != NULL;
+}
+
+// sprites leave the visibility grid together with any of the components they are rendered with
+void itu_observer_visibility_on_remove(ITU_EntityId* entity_ids, void* components_data, int count)
+{
+	for(int i = 0; i < count; ++i)
+		itu_sys_visibility_remove(entity_ids[i]);
+}
+
+#define TRANSFORM_LOCAL_NONE ((Uint32)-1)
+
+// computes world transforms, parents always before their children (breadth-first, so entities end up sorted by depth)
+// NOTE: the hierarchy is rebuilt from `TransformParent` every frame (just a couple of linear passes over frame memory),
+//       so there is no children list to keep in sync when entities get re-parented or destroyed.
+//       The expensive part (the actual math, and marking `TransformWorld` as changed) only happens for dirty subtrees
+// NOTE: allocates from the frame arena, so it has to run on the main thread (exclusive system)
+void itu_system_transform_propagate(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count)
+{
+	if(entity_ids_count == 0)
+		return;
+
+	ITU_Arena* arena = &context->arena_frame;
+	ITU_View<Transform, TransformWorld> view;
+
+	// entity index -> position in `entity_ids`
+	Uint32 index_max = 0;
+	for(int i = 0; i < entity_ids_count; ++i)
+		index_max = SDL_max(index_max, entity_ids[i].index);
+	Uint32* locals = arena_alloc_array(arena, Uint32, index_max + 1);
+	SDL_memset(locals, 0xff, sizeof(Uint32) * (index_max + 1));
+	for(int i = 0; i < entity_ids_count; ++i)
+		locals[entity_ids[i].index] = i;
+
+	// parent of every entity (TRANSFORM_LOCAL_NONE for roots), and children grouped by parent
+	Uint32* parents        = arena_alloc_array(arena, Uint32, entity_ids_count);
+	Uint32* children_first = arena_alloc_array(arena, Uint32, entity_ids_count + 1);
+	Uint32* children       = arena_alloc_array(arena, Uint32, entity_ids_count);
+	SDL_memset(children_first, 0, sizeof(Uint32) * (entity_ids_count + 1));
 	for(int i = 0; i < entity_ids_count; ++i)
 	{
+		parents[i] = TRANSFORM_LOCAL_NONE;
+
+		TransformParent* transform_parent = entity_get_data(entity_ids[i], TransformParent);
+		if(!transform_parent || transform_parent->parent.index > index_max)
+			continue;
+
+		Uint32 parent = locals[transform_parent->parent.index];
+		if(parent == TRANSFORM_LOCAL_NONE || entity_ids[parent].generation != transform_parent->parent.generation)
+			continue;
+
+		parents[i] = parent;
+		++children_first[parent + 1];
+	}
+	for(int i = 0; i < entity_ids_count; ++i)
+		children_first[i + 1] += children_first[i];
+
+	Uint32* queue = arena_alloc_array(arena, Uint32, entity_ids_count);
+	int queue_tail = 0;
+	{
+		// `queue` doubles as temporary cursor storage while grouping children
+		Uint32* cursors = queue;
+		SDL_memcpy(cursors, children_first, sizeof(Uint32) * entity_ids_count);
+		for(int i = 0; i < entity_ids_count; ++i)
+			if(parents[i] != TRANSFORM_LOCAL_NONE)
+				children[cursors[parents[i]]++] = i;
+	}
+	bool* reached = arena_alloc_array(arena, bool, entity_ids_count);
+	SDL_memset(reached, 0, sizeof(bool) * entity_ids_count);
+	for(int i = 0; i < entity_ids_count; ++i)
+	{
+		if(parents[i] == TRANSFORM_LOCAL_NONE)
+		{
+			queue[queue_tail++] = i;
+			reached[i] = true;
+		}
+	}
+
+	bool* dirty = arena_alloc_array(arena, bool, entity_ids_count);
+	int cycles_count = 0;
+	int unreached = 0;
+	for(int queue_head = 0; queue_head < entity_ids_count; ++queue_head)
+	{
+		if(queue_head == queue_tail)
+		{
+			// whatever was not reached is part of a cycle, or below one (`itu_sys_transform_set_parent()` rejects cycles,
+			// but `TransformParent` can still be written directly). Its ancestors are all unreached and none of them is a root,
+			// so walking up enough steps always lands inside the cycle. That entity becomes a root, and the cycle unrolls from there
+			while(reached[unreached])
+				++unreached;
+			Uint32 root = unreached;
+			for(int j = 0; j < entity_ids_count; ++j)
+				root = parents[root];
+			parents[root] = TRANSFORM_LOCAL_NONE;
+			queue[queue_tail++] = root;
+			reached[root] = true;
+			++cycles_count;
+		}
+
+		Uint32 i = queue[queue_head];
 		ITU_EntityId id = entity_ids[i];
-		Transform* transform = entity_get_data(id, Transform);
-		Sprite*    sprite = entity_get_data(id, Sprite);
+		Uint32 parent = parents[i];
+		ITU_EntityId parent_id = ITU_ENTITY_ID_NULL;
+		if(parent != TRANSFORM_LOCAL_NONE)
+			parent_id = entity_ids[parent];
+
+		TransformWorld* transform_world = &view.get<TransformWorld>(id);
+		dirty[i] =
+			(parent != TRANSFORM_LOCAL_NONE && dirty[parent]) ||
+			view.changed<Transform>(id) ||
+			view.changed<TransformWorld>(id) ||
+			transform_world->parent.index != parent_id.index || transform_world->parent.generation != parent_id.generation;
+
+		if(dirty[i])
+		{
+			transform_world = &view.get_mut<TransformWorld>(id);
+			TransformWorld* transform_world_parent = parent != TRANSFORM_LOCAL_NONE ? &view.get<TransformWorld>(parent_id) : NULL;
+			itu_sys_transform_compose(transform_world, transform_world_parent, &view.get<Transform>(id));
+			transform_world->parent = parent_id;
+			transform_world->depth = transform_world_parent ? transform_world_parent->depth + 1 : 0;
+		}
 
-		itu_lib_sprite_render(context, sprite, transform);
+		for(Uint32 j = children_first[i]; j < children_first[i + 1]; ++j)
+		{
+			if(reached[children[j]])
+				continue;
+			queue[queue_tail++] = children[j];
+			reached[children[j]] = true;
+		}
+	}
+
+	if(cycles_count > 0)
+		SDL_Log("WARNING %d cycle(s) in the transform hierarchy, broken by treating one of their entities as a root\n", cycles_count);
+}
+
+// update game state from b2d state, interpolating when physics step is out of synch with game logic
+// NOTE: only reads from box2d, and every entity writes only its own components, so chunks can run in parallel
+void itu_system_physics_readback(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count)
+{
+	float t = (float)(context->accumulator_physics) / (float)PHYSICS_TIMESTEP_NSECS;
+	float t_inv = 1 - t;
+
+	ITU_View<Transform, PhysicsData> view;
+	for(int i = 0; i < entity_ids_count; ++i)
+	{
+		ITU_EntityId id = entity_ids[i];
+		// NOTE: PhysicsData only mirrors box2d state here, so it is not marked as changed (it would be pushed back to box2d next frame)
+		Transform*   transform    = &view.get_mut<Transform>(id);
+		PhysicsData* physics_data = &view.get<PhysicsData>(id);
+
+		b2Vec2 physics_vel = b2Body_GetLinearVelocity(physics_data->body_id);
+		float  physics_trq = b2Body_GetAngularVelocity(physics_data->body_id);
+		b2Vec2 physics_pos = b2Body_GetPosition(physics_data->body_id);
+		b2Rot  physics_rot = b2Body_GetRotation(physics_data->body_id);
+
+		physics_data->velocity = value_cast(vec2f, physics_vel) * t + physics_data->fixed_step_velocity * t_inv;
+		physics_data->torque   = physics_trq * t + physics_data->fixed_step_torque * t_inv;
+
+
+		if(!physics_data->ignore_position)
+			transform->position = value_cast(vec2f, physics_pos) * t + physics_data->fixed_step_position * t_inv;
+
+		if(!physics_data->ignore_rotation)
+			transform->rotation = b2Rot_GetAngle(physics_rot) * t + physics_data->fixed_step_rotation * t_inv;
+
+		physics_data->fixed_step_velocity = value_cast(vec2f, physics_vel);
+		physics_data->fixed_step_torque = physics_trq;
+		physics_data->fixed_step_position = value_cast(vec2f, physics_pos);
+		physics_data->fixed_step_rotation = b2Rot_GetAngle(physics_rot);
 	}
 }
 
 void itu_system_physics(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count)
 {
+	// NOTE: setters touch box2d internal state, so this has to stay serial
+	// NOTE: only bodies whose PhysicsData was written (with a mutable accessor) since last frame are updated
+	ITU_View<PhysicsData> view;
 	for(int i = 0; i < entity_ids_count; ++i)
 	{
 		ITU_EntityId id = entity_ids[i];
-		PhysicsData* physics_data = entity_get_data(id, PhysicsData);
+		if(!view.changed<PhysicsData>(id))
+			continue;
 
+		PhysicsData* physics_data = &view.get<PhysicsData>(id);
 		b2Body_SetLinearVelocity(physics_data->body_id, value_cast(b2Vec2, physics_data->velocity));
 		b2Body_SetAngularVelocity(physics_data->body_id, physics_data->torque);
 	}
@@ -31,38 +252,64 @@ void itu_system_physics(SDLContext* context, ITU_EntityId* entity_ids, int entit
 		context->physics_steps_count++;
 		context->accumulator_physics -= PHYSICS_TIMESTEP_NSECS;
 
-		// update game state from b2d state, interpolating when physics step is out of synch with game logic
 		// NOTE: we need to read the b2d state every step in order to get a correct interpolation, even if it's wasteful
 		//       (there is definitely a way to adjust `t` and `t_inv` based on the numbers of steps done and do the reading only once,
 		//       marking it as a TODO for the future)
-		float t = (float)(context->accumulator_physics) / (float)PHYSICS_TIMESTEP_NSECS;
-		float t_inv = 1 - t;
-
-		for(int i = 0; i < entity_ids_count; ++i)
-		{
-			ITU_EntityId id = entity_ids[i];
-			Transform*  transform = entity_get_data(id, Transform);
-			PhysicsData* physics_data = entity_get_data(id, PhysicsData);
+		itu_sys_estorage_parallel_for(context, entity_ids, entity_ids_count, itu_system_physics_readback);
+	}
+}
 
-			b2Vec2 physics_vel = b2Body_GetLinearVelocity(physics_data->body_id);
-			float  physics_trq = b2Body_GetAngularVelocity(physics_data->body_id);
-			b2Vec2 physics_pos = b2Body_GetPosition(physics_data->body_id);
-			b2Rot  physics_rot = b2Body_GetRotation(physics_data->body_id);
+// box2d bodies are owned by their component, they go away with it (shapes attached to them too)
+void itu_observer_physics_on_remove(ITU_EntityId* entity_ids, void* components_data, int count)
+{
+	PhysicsData* physics_data = (PhysicsData*)components_data;
+	for(int i = 0; i < count; ++i)
+		itu_sys_physics_remove_body(physics_data[i].body_id);
+}
 
-			physics_data->velocity = value_cast(vec2f, physics_vel) * t + physics_data->fixed_step_velocity * t_inv;
-			physics_data->torque   = physics_trq * t + physics_data->fixed_step_torque * t_inv;
+void itu_observer_physics_static_on_remove(ITU_EntityId* entity_ids, void* components_data, int count)
+{
+	PhysicsStaticData* physics_data = (PhysicsStaticData*)components_data;
+	for(int i = 0; i < count; ++i)
+		itu_sys_physics_remove_body(physics_data[i].body_id);
+}
 
+bool itu_load_fixup_body_is_owned(b2BodyId body_id, ITU_EntityId id)
+{
+	return b2Body_IsValid(body_id) && itu_sys_physics_get_entity(body_id) == value_cast(void*, id);
+}
 
-			if(!physics_data->ignore_position)
-				transform->position = value_cast(vec2f, physics_pos) * t + physics_data->fixed_step_position * t_inv;
+// bodies are not part of snapshots: restored components can only take back bodies that still exist (and still belong to the same entity).
+// The saved state is pushed back into them, so that the simulation rolls back too
+bool itu_load_fixup_physics(ITU_EntityId id, void* data)
+{
+	PhysicsData* physics_data = (PhysicsData*)data;
+	if(!itu_load_fixup_body_is_owned(physics_data->body_id, id))
+	{
+		physics_data->body_id = b2_nullBodyId;
+		return false;
+	}
 
-			if(!physics_data->ignore_rotation)
-				transform->rotation = b2Rot_GetAngle(physics_rot) * t + physics_data->fixed_step_rotation * t_inv;
+	b2Body_SetTransform(physics_data->body_id, value_cast(b2Vec2, physics_data->fixed_step_position), b2MakeRot(physics_data->fixed_step_rotation));
+	b2Body_SetLinearVelocity(physics_data->body_id, value_cast(b2Vec2, physics_data->fixed_step_velocity));
+	b2Body_SetAngularVelocity(physics_data->body_id, physics_data->fixed_step_torque);
+	return true;
+}
 
-			physics_data->fixed_step_velocity = value_cast(vec2f, physics_vel);
-			physics_data->fixed_step_torque = physics_trq;
-			physics_data->fixed_step_position = value_cast(vec2f, physics_pos);
-			physics_data->fixed_step_rotation = b2Rot_GetAngle(physics_rot);
-		}
+bool itu_load_fixup_physics_static(ITU_EntityId id, void* data)
+{
+	PhysicsStaticData* physics_data = (PhysicsStaticData*)data;
+	if(!itu_load_fixup_body_is_owned(physics_data->body_id, id))
+	{
+		physics_data->body_id = b2_nullBodyId;
+		return false;
 	}
+	return true;
+}
+
+// NOTE: shapes go away with their body
+bool itu_load_fixup_shape(ITU_EntityId id, void* data)
+{
+	ShapeData* shape_data = (ShapeData*)data;
+	return b2Shape_IsValid(shape_data->shape_id);
 }
@@ -1,5 +1,6 @@
 #ifndef ITU_UNITY_BUILD
 #include <itu_entity_storage.hpp>
+#include <itu_lib_jobs.hpp>
 #include <imgui/imgui.h>
 #endif
 
@@ -9,30 +10,64 @@ struct ITU_Component
 	const char* name;
 	
 	Uint64 element_size;
-	int count_max;
+	int count_capacity; // current size of `entity_ids` and `data`, they grow when full
 	int count_alive;
 
-	Uint64*       data_loc;   // maps EntityId.index to location in data array
+	// maps EntityId.index to location in data array (COMPONENT_LOC_NONE if the entity doesn't have the component).
+	// Split in pages of COMPONENT_PAGE_SIZE entries, allocated the first time an entity in their range gets the component,
+	// so that rarely used components don't pay for the whole index range
+	stbds_arr(Uint32*) data_loc_pages;
+
 	ITU_EntityId* entity_ids; // maps data array location to an EntityId
 	void*         data;
+	Uint32*       versions;   // world version of the last write to each element (see `itu_entity_data_get_mut()`)
+
+	Uint32 order_version; // incremented every time elements are added, removed or moved around
+
+	// incremental sorting, a few steps each frame (see `itu_sys_estorage_components_sort_update()`)
+	ITU_Component* sort_primary;              // if set, elements follow the order of this pool
+	ITU_ComponentSortKeyFunction fn_sort_key; // if set, elements are sorted by this key
+	int    sort_steps_per_frame;
+	Uint32 sort_cursor;
+	Uint32 sort_cursor_dst;      // next slot to fill when following `sort_primary`
+	Uint32 sort_gap;             // distance between compared elements when sorting by key (0 to start over)
+	Uint32 sort_pass_swaps;
+	Uint32 sort_version;         // `order_version` at the start of the current pass
+	Uint32 sort_version_primary; // `sort_primary->order_version` at the start of the current pass
+	bool   sort_clean;           // last pass completed without anything moving in either pool
+
+	Uint64 layout_hash; // identifies name, size and alignment of the component, to reject world files saved with a different layout
 
 	ITU_ComponendDebugUIRender fn_debug_ui_render;
+	ITU_ComponentLoadFixupFunction fn_load_fixup;
 };
 
-struct ITU_ComponentTagStorage
+// dense list of all the entities that have a specific tag
+// NOTE: checking if an entity has a tag only needs `ITU_Entity::tag_mask`, this is only used to iterate over the tagged entities
+struct ITU_Tag
 {
-	ITU_EntityId key;
+	stbds_arr(ITU_EntityId) entity_ids;
+	stbds_arr(int)          entity_locs; // maps EntityId.index to location in `entity_ids` (only valid if the entity has the tag)
 };
 
-struct ITU_ComponentTag
+// a single (source, relation, target) pair. Pairs with the same target are linked together (reverse index)
+struct ITU_RelationPair
 {
-	ITU_ComponentType type;
-	const char* name;
-	
-	int count_max;
-	int count_alive;
+	ITU_EntityId source;
+	ITU_EntityId target;
+	Uint32 target_prev; // location in `pairs` of the previous/next pair with the same target (COMPONENT_LOC_NONE at the ends)
+	Uint32 target_next;
+};
+
+struct ITU_Relation
+{
+	stbds_arr(ITU_RelationPair) pairs;
+	// NOTE: both grow lazily, indices past the end mean "none"
+	stbds_arr(Uint32) source_locs;  // maps EntityId.index of the source to its pair location in `pairs`
+	stbds_arr(Uint32) target_heads; // maps EntityId.index of the target to the location in `pairs` of the first pair pointing to it
 
-	ITU_ComponentTagStorage* entitiy_ids;
+	bool destroy_with_target; // destroying the target destroys the sources too, instead of just removing the pairs
+	const char* debug_name;
 };
 
 struct ITU_System
@@ -44,13 +79,131 @@ struct ITU_System
 	ITU_TagType tags[SYSTEM_TAGS_MAX];
 	int tags_count;
 
+	ITU_Mask component_mask;
+	ITU_Mask tag_mask;
+	ITU_Mask component_mask_read;
+	ITU_Mask component_mask_write;
+
+	// systems in the same phase don't conflict with each other, and run in parallel
+	int phase;
+
+	// archetypes whose signature contains all the components required by the system
+	// NOTE: archetypes are never destroyed, so we only need to check the ones created after the last update
+	stbds_arr(int) archetypes;
+	int archetypes_checked_count;
+
+	// persistent list of the entities currently matching the system
+	stbds_arr(ITU_EntityId) entity_ids;
+	stbds_arr(int)          entity_locs; // maps EntityId.index to location in `entity_ids` (-1 if not matching)
+
+	// `entity_ids` follows the order of this pool, a few steps each frame (see `itu_system_sort_align_steps()`)
+	ITU_Component* order_pool;
+	Uint32 order_version;     // incremented every time entities are added, removed or moved around in `entity_ids`
+	Uint32 sort_cursor;
+	Uint32 sort_cursor_dst;
+	Uint32 sort_version;      // `order_version` at the start of the current pass
+	Uint32 sort_version_pool; // `order_pool->order_version` at the start of the current pass
+	bool   sort_clean;
+
 	ITU_SystemUpdateFunction fn_update;
+	ITU_SystemUpdateChunkFunction fn_update_chunk;
+
+	Uint32 last_run_version; // world version of the last time the system ran
+};
+
+// group of all the entities that share the exact same component signature
+// NOTE: component data still lives in the component pools (one contiguous array per component), the archetype only
+//       owns the contiguous list of entities, so that systems can grab all the matching entities without checking them one by one
+struct ITU_Archetype
+{
+	ITU_Mask component_mask;
+	stbds_arr(ITU_EntityId) entity_ids;
+};
+
+struct ITU_Query
+{
+	ITU_QueryDef def;
+
+	// same incremental archetype matching as systems
+	stbds_arr(int) archetypes;
+	int archetypes_checked_count;
+
+	// flat list of all matching entities, rebuilt lazily when anything structural changed since the last time,
+	// or when the pool it follows the order of was reordered
+	stbds_arr(ITU_EntityId) entity_ids;
+	Uint64 structural_version;
+	ITU_Component* order_pool;
+	Uint32 order_version_pool;
+};
+
+struct ITU_SystemJobData
+{
+	SDLContext* context;
+	ITU_SystemUpdateFunction fn_update;
+	ITU_EntityId* entity_ids;
+	int entity_ids_count;
+	Uint32 last_run_version;
+};
+
+enum ITU_CommandType
+{
+	ITU_COMMAND_ENTITY_CREATE,
+	ITU_COMMAND_ENTITIES_INSTANTIATE, // payload: `ITU_CommandInstantiate` followed by the reserved ids
+	ITU_COMMAND_ENTITY_DESTROY,
+	ITU_COMMAND_COMPONENT_ADD,
+	ITU_COMMAND_COMPONENT_REMOVE,
+	ITU_COMMAND_TAG_ADD,
+	ITU_COMMAND_TAG_REMOVE,
+	ITU_COMMAND_RELATION_SET,         // payload: target `ITU_EntityId`
+	ITU_COMMAND_RELATION_REMOVE,
+};
+
+// header of a single deferred structural change. It's followed by `payload_size` bytes of data
+// (for now only used by `ITU_COMMAND_COMPONENT_ADD`, to store the initial component value)
+struct ITU_Command
+{
+	ITU_EntityId id;
+	Uint32 payload_size; // always a multiple of 8, so that the next header stays aligned
+	Uint8  type;
+	Uint8  arg;          // component type, tag or relation, depending on `type`
+};
+
+struct ITU_CommandInstantiate
+{
+	ITU_Prefab* prefab; // NULL for plain empty entities
+	int count;
+};
+
+// template for spawning many entities at once: a signature, plus the initial value of each component
+struct ITU_Prefab
+{
+	ITU_Mask component_mask;
+	ITU_Mask tag_mask;
+	void*    component_defaults[COMPONENTS_COUNT_MAX]; // NULL means zero-initialized
 };
 
 struct ITU_Entity
 {
 	ITU_EntityId id;
-	Uint64 component_mask;
+	ITU_Mask component_mask;
+	ITU_Mask tag_mask;
+
+	int archetype;     // index in `ctx.archetypes`
+	int archetype_loc; // location in the archetype's `entity_ids` array
+};
+
+struct ITU_Observer
+{
+	ITU_ObserverEvent event;
+	ITU_ComponentType component_type; // ignored for ITU_OBSERVER_ON_DESTROY
+	ITU_ObserverFunction fn;
+};
+
+// events waiting to be dispatched to the observers of a single (event, component type)
+struct ITU_ObserverQueue
+{
+	stbds_arr(ITU_EntityId) entity_ids;
+	stbds_arr(Uint8)        components_data; // only for ITU_OBSERVER_ON_REMOVE
 };
 
 struct ITU_EntityStorageContext
@@ -61,10 +214,57 @@ struct ITU_EntityStorageContext
 	ITU_Component* components[COMPONENTS_COUNT_MAX];
 	int components_count;
 
-	ITU_ComponentTagStorage* tags[TAGS_COUNT_MAX];
+	ITU_Tag tags[TAGS_COUNT_MAX];
+	ITU_Relation relations[RELATIONS_COUNT_MAX];
 
 	ITU_System systems[SYSTEMS_COUNT_MAX];
 	int systems_count;
+	int systems_phases_count;
+
+	stbds_arr(ITU_Archetype)  archetypes;
+	stbds_hm(ITU_Mask, int)   archetypes_lookup; // maps a component signature to its location in `archetypes`
+
+	// deferred structural changes, one buffer per thread (indexed by `itu_lib_jobs_get_thread_index()`) so that recording doesn't need locks
+	stbds_arr(Uint8) commands[ITU_JOBS_WORKERS_MAX + 1];
+	int defer_depth;
+	Uint32 entities_index_next; // first index never handed out (past the end of `entities` while deferred creates are pending)
+	SDL_Mutex* entities_reserve_mutex;
+
+	// ids for bulk creations, when the caller doesn't need them back
+	stbds_arr(ITU_EntityId) instantiate_ids_scratch;
+
+	// level-scoped memory (see `SDLContext::arena_level`), used for debug names
+	ITU_Arena* arena_level;
+
+	// maps archetype indices of a snapshot being restored to the current ones
+	stbds_arr(int) restore_archetypes_remap;
+
+	// world files (see `itu_sys_estorage_load()`): id of this run, and textures saved in the file being loaded, mapped to the current ones
+	Uint64 session_id;
+	stbds_hm(Uint64, SDL_Texture*) load_textures_remap;
+	bool loading;
+	bool loading_same_session;
+
+	// incremented every time any entity signature changes (or entities are created/destroyed), used to invalidate cached query results
+	Uint64 structural_version;
+
+	// incremented before every phase of systems (and after it, before applying its structural changes), used to track component writes.
+	// Every write done through a mutable accessor stamps the element with the current world version
+	// NOTE: a Uint32 lasts for years at a few increments per frame
+	Uint32 world_version;
+
+	// weak references table (see `itu_weakref_create()`), freed slots are kept as ITU_ENTITY_ID_NULL
+	stbds_arr(ITU_EntityId) weak_refs;
+	stbds_arr(ITU_WeakRef)  weak_refs_free;
+	Uint64 weak_refs_structural_version; // `structural_version` at the time of the last resolve
+
+	// observers, and their pending events (ITU_OBSERVER_ON_DESTROY only uses the queue for component type 0).
+	// Events are only queued for (event, component type) pairs that someone observes
+	stbds_arr(ITU_Observer) observers;
+	ITU_ObserverQueue observer_queues[ITU_OBSERVER_EVENT_MAX][COMPONENTS_COUNT_MAX];
+	ITU_Mask observed_masks[ITU_OBSERVER_EVENT_MAX];
+	bool observers_pending;
+	bool observers_dispatching;
 
 	// debug properties
 	stbds_hm(ITU_EntityId, char*) entities_debug_names;
@@ -74,51 +274,122 @@ struct ITU_EntityStorageContext
 static ITU_ComponentType component_type_counter;
 static ITU_EntityStorageContext ctx;
 
-ITU_Component* itu_component_pool_create(size_t element_size, Uint64 total_num_component, const char* component_name);
+// what `itu_entity_is_valid()` looks at for out of range indices, never matches any id
+static const ITU_Entity estorage_entity_sentinel = { { { { 0, (Uint32)-1 } } } };
+
+// `last_run_version` of the system running on this thread (0 outside of systems, so everything counts as changed)
+static thread_local Uint32 estorage_thread_last_run_version;
+
+#define ITU_HASH_FNV1A_SEED 0xcbf29ce484222325ull
+
+Uint64 itu_hash_fnv1a(const void* data, Uint64 size, Uint64 hash)
+{
+	const Uint8* bytes = (const Uint8*)data;
+	for(Uint64 i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	return hash;
+}
+
+ITU_Component* itu_component_pool_create(size_t element_size, int capacity, const char* component_name);
 void  itu_component_pool_assign(ITU_Component* component_pool, ITU_EntityId entity);
 void  itu_component_pool_data_get(ITU_Component* component_pool, ITU_EntityId entity, void* out_data_copy);
 void  itu_component_pool_data_set(ITU_Component* component_pool, ITU_EntityId entity, void* in_data_copy);
 void  itu_component_pool_remove(ITU_Component* component_pool, ITU_EntityId entity);
 void  itu_component_pool_clear(ITU_Component* component_pool);
 int   itu_system_get_matching_entities(ITU_System* system, ITU_EntityId* out_entitiy_group);
-
-ITU_Component* itu_component_pool_create(Uint64 element_size, Uint64 total_num_component, const char* component_name)
+int   itu_archetype_get(ITU_Mask component_mask);
+void  itu_archetype_entity_add(int archetype, ITU_EntityId id);
+void  itu_archetype_entity_remove(ITU_EntityId id);
+void  itu_systems_entity_refresh(ITU_EntityId id);
+void  itu_observers_queue(ITU_ObserverEvent event, ITU_ComponentType component_type, ITU_EntityId* ids, int count);
+ITU_Component* itu_component_pool_order_get(ITU_Mask component_mask);
+
+// grows the dense arrays so that they can hold at least `count` elements
+void itu_component_pool_reserve(ITU_Component* component_pool, int count)
 {
-	// common pattern: we are allocating enough space for the metadata (ITU_Component) + the array data
-	size_t size_metadata   = sizeof(ITU_Component);
-	size_t size_data_loc   = sizeof(Uint64) * ENTITIES_COUNT_MAX;
-	size_t size_entity_ids = sizeof(ITU_EntityId) * total_num_component;
-	size_t size_data       = element_size * total_num_component;
-	size_t total_size = size_metadata + size_data_loc + size_entity_ids + size_data;
+	if(count <= component_pool->count_capacity)
+		return;
+
+	// NOTE: doubling keeps the number of reallocs (and data copies) logarithmic with the number of elements
+	int capacity = SDL_max(count, component_pool->count_capacity * 2);
+	component_pool->entity_ids = (ITU_EntityId*)SDL_realloc(component_pool->entity_ids, sizeof(ITU_EntityId) * capacity);
+	component_pool->data       = SDL_realloc(component_pool->data, component_pool->element_size * capacity);
+	component_pool->versions   = (Uint32*)SDL_realloc(component_pool->versions, sizeof(Uint32) * capacity);
+	component_pool->count_capacity = capacity;
+}
 
-	ITU_Component* ret = (ITU_Component*)SDL_malloc(total_size);
-	SDL_memset(ret, -1, total_size);
+// `capacity`: number of elements to allocate upfront. The pool still grows past it if needed
+ITU_Component* itu_component_pool_create(Uint64 element_size, int capacity, const char* component_name)
+{
+	ITU_Component* ret = (ITU_Component*)SDL_malloc(sizeof(ITU_Component));
+	SDL_zerop(ret);
 
 	ret->name = component_name;
 	ret->element_size = element_size;
-	ret->count_max = total_num_component;
-	ret->count_alive = 0;
+	itu_component_pool_reserve(ret, capacity);
 
-	
-	//Uint64* valid = (Uint64*)((unsigned char*)ret + size_metadata);
+	return ret;
+}
+
+Uint32 itu_component_pool_loc_get(ITU_Component* component_pool, Uint32 entity_index)
+{
+	Uint32 page = entity_index >> COMPONENT_PAGE_SHIFT;
+	if(page >= stbds_arrlen(component_pool->data_loc_pages) || !component_pool->data_loc_pages[page])
+		return COMPONENT_LOC_NONE;
 
-	ret->data_loc   = pointer_offset(Uint64, ret, size_metadata);                 // first array starts at the end of the metadata
-	ret->entity_ids = pointer_offset(ITU_EntityId, ret->data_loc, size_data_loc); // second array starts at the end of first array
-	ret->data       = pointer_offset(void, ret->entity_ids, size_entity_ids);     // third array starts at the end of second array
+	return component_pool->data_loc_pages[page][entity_index & (COMPONENT_PAGE_SIZE - 1)];
+}
 
-	ret->fn_debug_ui_render = NULL;
+ITU_ComponentPoolView itu_component_pool_view(ITU_ComponentType component_type)
+{
+	SDL_assert(component_type < ctx.components_count);
+	ITU_Component* component_pool = ctx.components[component_type];
 
+	ITU_ComponentPoolView ret;
+	ret.loc_pages = component_pool->data_loc_pages;
+	ret.data = component_pool->data;
+	ret.versions = component_pool->versions;
 	return ret;
 }
 
-ITU_ComponentType itu_sys_estorage_add_component_pool(Uint64 element_size, Uint64 total_num_component, ITU_ComponentType* ref_component_type, const char* component_name);
+void itu_component_pool_loc_set(ITU_Component* component_pool, Uint32 entity_index, Uint32 loc)
+{
+	Uint32 page = entity_index >> COMPONENT_PAGE_SHIFT;
+	int pages_count = stbds_arrlen(component_pool->data_loc_pages);
+	if(page >= pages_count)
+	{
+		stbds_arrsetlen(component_pool->data_loc_pages, page + 1);
+		for(int i = pages_count; i <= page; ++i)
+			component_pool->data_loc_pages[i] = NULL;
+	}
+
+	if(!component_pool->data_loc_pages[page])
+	{
+		component_pool->data_loc_pages[page] = (Uint32*)SDL_malloc(sizeof(Uint32) * COMPONENT_PAGE_SIZE);
+		SDL_memset(component_pool->data_loc_pages[page], 0xff, sizeof(Uint32) * COMPONENT_PAGE_SIZE); // COMPONENT_LOC_NONE
+	}
+
+	component_pool->data_loc_pages[page][entity_index & (COMPONENT_PAGE_SIZE - 1)] = loc;
+}
+
+ITU_ComponentType itu_sys_estorage_add_component_pool(Uint64 element_size, Uint64 element_align, int capacity, ITU_ComponentType* ref_component_type, const char* component_name);
 void itu_sys_estorage_add_component_debug_ui_render(ITU_ComponentType component_type, ITU_ComponendDebugUIRender fn_debug_ui_render)
 ;
 
-void itu_sys_estorage_init(int starting_entities_count, bool enable_standard_components=true)
+void itu_sys_estorage_init(SDLContext* context, int starting_entities_count, bool enable_standard_components=true)
 {
+	ctx.arena_level = &context->arena_level;
+	ctx.world_version = 1;
+	ctx.session_id = SDL_GetPerformanceCounter() ^ SDL_GetTicksNS();
+
 	// allocate a minimum of elements at initialization time, to minimize early reallocs
-	stbds_arrsetlen(ctx.entities, starting_entities_count);
+	stbds_arrsetcap(ctx.entities, starting_entities_count);
+
+	// the empty archetype always exists, since that's where entities are created
+	itu_archetype_get(0);
+
+	itu_lib_jobs_init(0);
+	ctx.entities_reserve_mutex = SDL_CreateMutex();
 	//stbds_hmset(ctx.entities_debug_names, starting_entities_count);
 
 	if(enable_standard_components)
@@ -128,22 +399,64 @@ void itu_sys_estorage_init(int starting_entities_count, bool enable_standard_com
 		enable_component(PhysicsData);
 		enable_component(PhysicsStaticData);
 		enable_component(ShapeData);
+		enable_component(TransformParent);
+		enable_component(TransformWorld);
+		enable_component(Tilemap);
 
 		add_component_debug_ui_render(ShapeData, itu_debug_ui_render_shapedata);
 		add_component_debug_ui_render(Transform, itu_debug_ui_render_transform);
 		add_component_debug_ui_render(Sprite, itu_debug_ui_render_sprite);
 		add_component_debug_ui_render(PhysicsData, itu_debug_ui_render_physicsdata);
 		add_component_debug_ui_render(PhysicsStaticData, itu_debug_ui_render_physicsstaticdata);
-
-		add_system(itu_system_physics       , component_mask(PhysicsData)                                  , 0);
-		add_system(itu_system_sprite_render , component_mask(Transform)   | component_mask(Sprite)         , 0);
+		add_component_debug_ui_render(TransformParent, itu_debug_ui_render_transformparent);
+		add_component_debug_ui_render(TransformWorld, itu_debug_ui_render_transformworld);
+		add_component_debug_ui_render(Tilemap, itu_debug_ui_render_tilemap);
+
+		// these are almost always accessed together with Transform, keep them in the same order
+		component_sort_align(Sprite, Transform);
+		component_sort_align(PhysicsData, Transform);
+		component_sort_align(TransformWorld, Transform);
+
+		add_observer_on_remove(PhysicsData, itu_observer_physics_on_remove);
+		add_observer_on_remove(PhysicsStaticData, itu_observer_physics_static_on_remove);
+		add_observer_on_remove(Sprite, itu_observer_visibility_on_remove);
+		add_observer_on_remove(TransformWorld, itu_observer_visibility_on_remove);
+		add_observer_on_remove(Tilemap, itu_observer_tilemap_on_remove);
+
+		// everything owning (or pointing to) resources outside of the entity storage checks them after a restore
+		add_component_load_fixup(Sprite, itu_load_fixup_sprite);
+		add_component_load_fixup(PhysicsData, itu_load_fixup_physics);
+		add_component_load_fixup(PhysicsStaticData, itu_load_fixup_physics_static);
+		add_component_load_fixup(ShapeData, itu_load_fixup_shape);
+		add_component_load_fixup(Tilemap, itu_load_fixup_tilemap);
+
+		add_system(itu_system_physics            , component_mask(PhysicsData)                                   , 0);
+		add_system(itu_system_transform_propagate, component_mask(Transform)      | component_mask(TransformWorld), 0);
+		add_system(itu_system_tilemap_render     , component_mask(TransformWorld) | component_mask(Tilemap)       , 0);
+		add_system(itu_system_sprite_render      , component_mask(TransformWorld) | component_mask(Sprite)        , 0);
 	}
 }
 
-ITU_ComponentType itu_sys_estorage_add_component_pool(Uint64 element_size, Uint64 total_num_component, ITU_ComponentType* ref_component_type, const char* component_name)
+// clears all entities (so that observers free whatever they own) and stops the worker threads started by `itu_sys_estorage_init()`
+void itu_sys_estorage_shutdown()
 {
-	ITU_Component* pool = itu_component_pool_create(element_size, total_num_component, component_name);
+	itu_sys_estorage_clear_all_entities();
+
+	itu_lib_jobs_shutdown();
+	SDL_DestroyMutex(ctx.entities_reserve_mutex);
+	ctx.entities_reserve_mutex = NULL;
+}
+
+ITU_ComponentType itu_sys_estorage_add_component_pool(Uint64 element_size, Uint64 element_align, int capacity, ITU_ComponentType* ref_component_type, const char* component_name)
+{
+	ITU_Component* pool = itu_component_pool_create(element_size, capacity, component_name);
 	pool->type = ctx.components_count++;
+
+	// NOTE: we can't see the fields, so a component that only reorders (or changes the type of) same-sized fields
+	//       keeps the same hash. Renaming the struct is the easy way to force old files out
+	pool->layout_hash = itu_hash_fnv1a(component_name, SDL_strlen(component_name), ITU_HASH_FNV1A_SEED);
+	pool->layout_hash = itu_hash_fnv1a(&element_size, sizeof(element_size), pool->layout_hash);
+	pool->layout_hash = itu_hash_fnv1a(&element_align, sizeof(element_align), pool->layout_hash);
 	ctx.components[pool->type] = pool;
 
 	// make component type globally available
@@ -157,10 +470,173 @@ void itu_sys_estorage_add_component_debug_ui_render(ITU_ComponentType component_
 	ctx.components[component_type]->fn_debug_ui_render = fn_debug_ui_render;
 }
 
+// `fn_load_fixup` is called on every element of the pool after restoring a snapshot or loading a world file
+// (see `itu_sys_estorage_restore()`). Returning false removes the component
+void itu_sys_estorage_add_component_load_fixup(ITU_ComponentType component_type, ITU_ComponentLoadFixupFunction fn_load_fixup)
+{
+	ctx.components[component_type]->fn_load_fixup = fn_load_fixup;
+}
+
+// keeps the elements of `component_type` in the same order as the ones in `primary_type` (entities that don't have
+// the primary component end up at the back), so that iterating both for the same entities walks memory linearly.
+// Systems and queries requiring any of the two iterate their entities in this order too (see `itu_component_pool_order_get()`)
+// NOTE: don't create cycles (A follows B, B follows A), they would keep undoing each other's work
+void itu_sys_estorage_component_sort_align(ITU_ComponentType component_type, ITU_ComponentType primary_type, int steps_per_frame)
+{
+	SDL_assert(component_type != primary_type);
+
+	ITU_Component* component_pool = ctx.components[component_type];
+	component_pool->sort_primary = ctx.components[primary_type];
+	component_pool->fn_sort_key = NULL;
+	component_pool->sort_steps_per_frame = steps_per_frame;
+	component_pool->sort_cursor = 0;
+	component_pool->sort_cursor_dst = 0;
+	component_pool->sort_clean = false;
+}
+
+// keeps the elements of `component_type` sorted by `fn_sort_key` (ie, by texture for batching, or by y for depth)
+void itu_sys_estorage_component_sort_key(ITU_ComponentType component_type, ITU_ComponentSortKeyFunction fn_sort_key, int steps_per_frame)
+{
+	ITU_Component* component_pool = ctx.components[component_type];
+	component_pool->sort_primary = NULL;
+	component_pool->fn_sort_key = fn_sort_key;
+	component_pool->sort_steps_per_frame = steps_per_frame;
+	component_pool->sort_cursor = 0;
+	component_pool->sort_gap = 0;
+	component_pool->sort_pass_swaps = 0;
+	component_pool->sort_clean = false;
+}
+
 void itu_sys_estorage_clear_all_entities()
 {
+	SDL_assert(ctx.defer_depth == 0);
+
+	// report everything as removed/destroyed, so that resources owned through observers (bodies, textures, grid entries) are freed.
+	// Dispatched right away, while ids are still valid (they would match new entities reusing them otherwise)
+	// NOTE: this also delivers events that were still pending, and applies whatever structural changes observers request.
+	//       Anything they create is wiped below
+	for(int i = 0; i < ctx.components_count; ++i)
+		itu_observers_queue(ITU_OBSERVER_ON_REMOVE, i, ctx.components[i]->entity_ids, ctx.components[i]->count_alive);
+	for(int i = 0; i < stbds_arrlen(ctx.entities); ++i)
+		if(itu_entity_is_valid(ctx.entities[i].id))
+			itu_observers_queue(ITU_OBSERVER_ON_DESTROY, 0, &ctx.entities[i].id, 1);
+	itu_sys_estorage_observers_dispatch();
+	SDL_assert(!ctx.observers_pending);
+
+	++ctx.structural_version;
+
 	stbds_arrfree(ctx.entities);
+	ctx.entities_index_next = 0;
 	stbds_arrfree(ctx.entities_free);
+
+	// NOTE: ids are handed out from scratch again, so old references must be cleared now (they could match new entities)
+	ITU_EntityId id_null = ITU_ENTITY_ID_NULL;
+	for(int i = 0; i < stbds_arrlen(ctx.weak_refs); ++i)
+		ctx.weak_refs[i] = id_null;
+
+	for(int i = 0; i < ctx.components_count; ++i)
+		itu_component_pool_clear(ctx.components[i]);
+
+	for(int i = 0; i < TAGS_COUNT_MAX; ++i)
+		stbds_arrsetlen(ctx.tags[i].entity_ids, 0);
+
+	for(int i = 0; i < RELATIONS_COUNT_MAX; ++i)
+	{
+		stbds_arrsetlen(ctx.relations[i].pairs, 0);
+		stbds_arrsetlen(ctx.relations[i].source_locs, 0);
+		stbds_arrsetlen(ctx.relations[i].target_heads, 0);
+	}
+
+	// NOTE: we keep the archetypes around (and the systems' references to them), they will most likely be needed again
+	for(int i = 0; i < stbds_arrlen(ctx.archetypes); ++i)
+		stbds_arrsetlen(ctx.archetypes[i].entity_ids, 0);
+
+	for(int i = 0; i < ctx.systems_count; ++i)
+	{
+		stbds_arrsetlen(ctx.systems[i].entity_ids, 0);
+		stbds_arrsetlen(ctx.systems[i].entity_locs, 0);
+		ctx.systems[i].order_version++;
+	}
+
+	// NOTE: debug names live in the level arena, so they all go away with it
+	stbds_hmfree(ctx.entities_debug_names);
+	itu_lib_arena_reset(ctx.arena_level);
+}
+
+bool itu_system_is_exclusive(ITU_System* system);
+
+void itu_system_init(ITU_System* system_runtime, ITU_SystemDef* system_def)
+{
+	stbds_arrfree(system_runtime->archetypes);
+	stbds_arrfree(system_runtime->entity_ids);
+	stbds_arrfree(system_runtime->entity_locs);
+	SDL_zerop(system_runtime);
+
+	// build component pool pointers (this requires component pools to be alredy set up)
+	for(int j = 0; j < COMPONENTS_COUNT_MAX; ++j)
+		if(itu_mask_test(system_def->component_mask, j))
+			system_runtime->components[system_runtime->components_count++] = ctx.components[j];
+	for(int j = 0; j < TAGS_COUNT_MAX; ++j)
+		if(itu_mask_test(system_def->tag_mask, j))
+			system_runtime->tags[system_runtime->tags_count++] = j;
+	system_runtime->component_mask = system_def->component_mask;
+	system_runtime->tag_mask = system_def->tag_mask;
+	system_runtime->component_mask_read = system_def->component_mask_read;
+	system_runtime->component_mask_write = system_def->component_mask_write;
+	system_runtime->fn_update = system_def->fn_update;
+	system_runtime->fn_update_chunk = system_def->fn_update_chunk;
+	system_runtime->name = system_def->name;
+
+	// chunks run on worker threads, there is no such thing as an exclusive chunked system
+	SDL_assert(!system_runtime->fn_update_chunk || !itu_system_is_exclusive(system_runtime));
+
+	// systems can be added after entities have been created, so we need to do one full search to initialize the cache.
+	// From now on, it will be kept up to date by the functions that change entity signatures
+	int entities_count = stbds_arrlen(ctx.entities);
+	stbds_arrsetlen(system_runtime->entity_locs, entities_count);
+	for(int i = 0; i < entities_count; ++i)
+		system_runtime->entity_locs[i] = -1;
+
+	stbds_arrsetlen(system_runtime->entity_ids, entities_count);
+	int matching_count = itu_system_get_matching_entities(system_runtime, system_runtime->entity_ids);
+	stbds_arrsetlen(system_runtime->entity_ids, matching_count);
+	for(int i = 0; i < matching_count; ++i)
+		system_runtime->entity_locs[system_runtime->entity_ids[i].index] = i;
+}
+
+bool itu_system_is_exclusive(ITU_System* system)
+{
+	return itu_mask_is_zero(system->component_mask_read) && itu_mask_is_zero(system->component_mask_write);
+}
+
+// two systems conflict if one of them writes something the other one touches (or if we don't know what they touch)
+bool itu_system_conflicts(ITU_System* a, ITU_System* b)
+{
+	if(itu_system_is_exclusive(a) || itu_system_is_exclusive(b))
+		return true;
+
+	ITU_Mask a_access = a->component_mask_read | a->component_mask_write;
+	ITU_Mask b_access = b->component_mask_read | b->component_mask_write;
+	return itu_mask_intersects(a->component_mask_write, b_access) || itu_mask_intersects(b->component_mask_write, a_access);
+}
+
+// builds the dependency graph between systems, and flattens it in phases.
+// Each system goes in the phase right after the last earlier system it conflicts with, so that
+// - conflicting systems still run in registration order
+// - non conflicting systems run as early as possible, together with all the others in the same phase
+void itu_sys_estorage_schedule_build()
+{
+	ctx.systems_phases_count = 0;
+	for(int i = 0; i < ctx.systems_count; ++i)
+	{
+		ITU_System* system = &ctx.systems[i];
+		system->phase = 0;
+		for(int j = 0; j < i; ++j)
+			if(itu_system_conflicts(system, &ctx.systems[j]))
+				system->phase = SDL_max(system->phase, ctx.systems[j].phase + 1);
+
+		ctx.systems_phases_count = SDL_max(ctx.systems_phases_count, system->phase + 1);
+	}
 }
 
 void itu_sys_estorage_set_systems(ITU_SystemDef* systems, int systems_count)
@@ -169,26 +645,9 @@ void itu_sys_estorage_set_systems(ITU_SystemDef* systems, int systems_count)
 
 	ctx.systems_count = systems_count;
 	for(int i = 0; i < systems_count; ++i)
-	{
-		ITU_System* system_runtime = &ctx.systems[i];
-		ITU_SystemDef* system_def  = &systems[i];
+		itu_system_init(&ctx.systems[i], &systems[i]);
 
-		// build component pool pointers (this requires component pools to be alredy set up)
-		for(int j = 0; j < COMPONENTS_COUNT_MAX; ++j)
-		{
-			Uint64 component_bitmask = 1ll << j;
-			if(system_def->component_mask & component_bitmask)
-				system_runtime->components[system_runtime->components_count++] = ctx.components[j];
-		}
-		for(int j = 0; j < TAGS_COUNT_MAX; ++j)
-		{
-			Uint64 tag_bitmask = 1ll << j;
-			if(system_def->tag_mask & tag_bitmask)
-				system_runtime->tags[system_runtime->tags_count++] = j;
-		}
-		system_runtime->fn_update = system_def->fn_update;
-		system_runtime->name = system_def->name;
-	}
+	itu_sys_estorage_schedule_build();
 }
 
 void itu_sys_estorage_add_system(ITU_SystemDef system_def)
@@ -199,144 +658,454 @@ void itu_sys_estorage_add_system(ITU_SystemDef system_def)
 		return;
 	}
 
-	ITU_System* system_runtime = &ctx.systems[ctx.systems_count++];
+	itu_system_init(&ctx.systems[ctx.systems_count++], &system_def);
+	itu_sys_estorage_schedule_build();
+}
+
+bool itu_system_entity_matches(ITU_System* system, ITU_EntityId id)
+{
+	ITU_Entity* entity = &ctx.entities[id.index];
+	return itu_mask_contains(entity->component_mask, system->component_mask)
+	    && itu_mask_contains(entity->tag_mask, system->tag_mask);
+}
 
-	// build component pool pointers (this requires component pools to be alredy set up)
-	for(int j = 0; j < COMPONENTS_COUNT_MAX; ++j)
+void itu_system_entity_add(ITU_System* system, ITU_EntityId id)
+{
+	// grow the location lookup lazily, new entries are marked as not present
+	int locs_count = stbds_arrlen(system->entity_locs);
+	if(id.index >= locs_count)
 	{
-		Uint64 component_bitmask = 1ll << j;
-		if(system_def.component_mask & component_bitmask)
-			system_runtime->components[system_runtime->components_count++] = ctx.components[j];
+		stbds_arrsetlen(system->entity_locs, id.index + 1);
+		for(int i = locs_count; i <= id.index; ++i)
+			system->entity_locs[i] = -1;
 	}
-	for(int j = 0; j < TAGS_COUNT_MAX; ++j)
+
+	system->entity_locs[id.index] = stbds_arrlen(system->entity_ids);
+	stbds_arrput(system->entity_ids, id);
+	system->order_version++;
+}
+
+void itu_system_entity_remove(ITU_System* system, ITU_EntityId id)
+{
+	// swap-remove, fixing up the location of the entity we moved
+	int loc_curr = system->entity_locs[id.index];
+	int loc_last = stbds_arrlen(system->entity_ids) - 1;
+	ITU_EntityId id_last = system->entity_ids[loc_last];
+	system->entity_ids[loc_curr] = id_last;
+	system->entity_locs[id_last.index] = loc_curr;
+	system->entity_locs[id.index] = -1;
+	stbds_arrpop(system->entity_ids);
+	system->order_version++;
+}
+
+bool itu_system_entity_has(ITU_System* system, ITU_EntityId id)
+{
+	return id.index < stbds_arrlen(system->entity_locs) && system->entity_locs[id.index] != -1;
+}
+
+// brings all the system caches up to date after the signature (components or tags) of the given entity changed
+// NOTE: queries are not updated here, they get rebuilt lazily the next time they are used
+void itu_systems_entity_refresh(ITU_EntityId id)
+{
+	++ctx.structural_version;
+
+	for(int i = 0; i < ctx.systems_count; ++i)
 	{
-		Uint64 tag_bitmask = 1ll << j;
-		if(system_def.tag_mask & tag_bitmask)
-			system_runtime->tags[system_runtime->tags_count++] = j;
+		ITU_System* system = &ctx.systems[i];
+		bool has     = itu_system_entity_has(system, id);
+		bool matches = itu_entity_is_valid(id) && itu_system_entity_matches(system, id);
+		if(matches && !has)
+			itu_system_entity_add(system, id);
+		else if(!matches && has)
+			itu_system_entity_remove(system, id);
 	}
-	system_runtime->fn_update = system_def.fn_update;
-	system_runtime->name = system_def.name;
 }
 
-
 int itu_system_get_matching_entities(ITU_System* system, ITU_EntityId* out_entitiy_group)
 {
-	ITU_EntityId* min_component;
-	Uint64  min_component_size = ENTITIES_COUNT_MAX + 1;
 	int system_ids_count = 0;
 
-	for(int j = 0; j < system->components_count; ++j)
-		if(system->components[j]->count_alive < min_component_size)
-		{
-			min_component = system->components[j]->entity_ids;
-			min_component_size = system->components[j]->count_alive;
-		}
+	// pick up archetypes created since the last time we checked
+	int archetypes_count = stbds_arrlen(ctx.archetypes);
+	for(int i = system->archetypes_checked_count; i < archetypes_count; ++i)
+		if(itu_mask_contains(ctx.archetypes[i].component_mask, system->component_mask))
+			stbds_arrput(system->archetypes, i);
+	system->archetypes_checked_count = archetypes_count;
 
-	for(int j = 0; j < system->tags_count; ++j)
+	for(int i = 0; i < stbds_arrlen(system->archetypes); ++i)
 	{
-		auto tmp = ctx.tags[system->tags[j]];
-		if(!tmp)
-			continue;
-		if(stbds_hmlen(tmp) < min_component_size)
-		{
-			min_component = (ITU_EntityId*)tmp;
-			min_component_size = stbds_hmlen(tmp);
-		}
-	}
+		ITU_Archetype* archetype = &ctx.archetypes[system->archetypes[i]];
+		int archetype_entities_count = stbds_arrlen(archetype->entity_ids);
 
-	// filter entities
-	for(int k = 0; k < min_component_size; ++k)
-	{
-		ITU_EntityId entity_curr = min_component[k];
-		bool filter_out = false;
-		for(int j = 0; j < system->components_count; ++j)
+		// every entity in a matching archetype is guaranteed to have all the components,
+		// so we can copy the whole group at once
+		if(system->tags_count == 0)
 		{
-			ITU_Component* filtered_component = system->components[j];
-
-			if(filtered_component->data_loc[entity_curr.index] == -1)
-			{
-				filter_out = true;
-				break;
-			}
+			SDL_memcpy(out_entitiy_group + system_ids_count, archetype->entity_ids, sizeof(ITU_EntityId) * archetype_entities_count);
+			system_ids_count += archetype_entities_count;
+			continue;
 		}
 
-		for(int j = 0; j < system->tags_count; ++j)
+		// tags are not part of the signature, so they still need to be filtered one by one
+		for(int k = 0; k < archetype_entities_count; ++k)
 		{
-			ITU_TagType filtered_tag = system->tags[j];
-				
-			if(stbds_hmgeti(ctx.tags[filtered_tag], entity_curr) == -1)
-			{
-				filter_out = true;
-				break;
-			}
+			ITU_EntityId entity_curr = archetype->entity_ids[k];
+			if(itu_mask_contains(ctx.entities[entity_curr.index].tag_mask, system->tag_mask))
+				out_entitiy_group[system_ids_count++] = entity_curr;
 		}
-		if(!filter_out)
-			out_entitiy_group[system_ids_count++] = entity_curr;
 	}
 
 	return system_ids_count;
 }
 
-void itu_sys_estorage_systems_update(SDLContext* context)
+void itu_system_run(ITU_SystemJobData* data)
 {
-	for(int i = 0; i < ctx.systems_count; ++i)
-	{
-		ITU_System* system = &ctx.systems[i];
-		ITU_EntityId system_ids[ENTITIES_COUNT_MAX];
-		int system_ids_count = itu_system_get_matching_entities(system, system_ids);
+	Uint32 last_run_version_prev = estorage_thread_last_run_version;
+	estorage_thread_last_run_version = data->last_run_version;
+	data->fn_update(data->context, data->entity_ids, data->entity_ids_count);
+	estorage_thread_last_run_version = last_run_version_prev;
+}
 
-		system->fn_update(context, system_ids, system_ids_count);
-	}
+void itu_system_job_update(void* userdata)
+{
+	itu_system_run((ITU_SystemJobData*)userdata);
 }
 
-enum ITU_SysEstorageDebugDetailCategory { ITU_SYS_ESTORAGE_DETAIL_CATEGORY_ENTITY, ITU_SYS_ESTORAGE_DETAIL_CATEGORY_SYSTEM, ITU_SYS_ESTORAGE_DETAIL_CATEGORY_MAX };
+int itu_system_chunk_size(int entity_ids_count)
+{
+	// a few chunks per thread, so that a slow chunk doesn't leave all the other threads waiting at the end of the phase
+	int chunks_target = itu_lib_jobs_get_threads_count() * 4;
+	return SDL_max(SYSTEM_CHUNK_SIZE_MIN, (entity_ids_count + chunks_target - 1) / chunks_target);
+}
 
-void itu_sys_estorage_debug_render_detail_entity(SDLContext* context, ITU_EntityId id)
+int itu_system_chunks_count(int entity_ids_count)
 {
-	if(!itu_entity_is_valid(id))
+	int chunk_size = itu_system_chunk_size(entity_ids_count);
+	return (entity_ids_count + chunk_size - 1) / chunk_size;
+}
+
+// splits the given entities in contiguous chunks, adding one job for each of them. Returns the number of jobs added
+// NOTE: there must be space for `itu_system_chunks_count()` more jobs
+int itu_system_jobs_add_chunks(ITU_Job* jobs, ITU_SystemJobData* jobs_data, SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count, ITU_SystemUpdateChunkFunction fn_update_chunk, Uint32 last_run_version)
+{
+	int chunk_size = itu_system_chunk_size(entity_ids_count);
+
+	int ret = 0;
+	for(int first = 0; first < entity_ids_count; first += chunk_size, ++ret)
 	{
-		ImGui::Text("INVALID ENTITY");
+		jobs_data[ret].context = context;
+		jobs_data[ret].fn_update = fn_update_chunk;
+		jobs_data[ret].entity_ids = entity_ids + first;
+		jobs_data[ret].entity_ids_count = SDL_min(chunk_size, entity_ids_count - first);
+		jobs_data[ret].last_run_version = last_run_version;
+		jobs[ret].fn = itu_system_job_update;
+		jobs[ret].userdata = &jobs_data[ret];
+	}
+	return ret;
+}
+
+// runs `fn_update_chunk` on slices of the given entities, in parallel. Returns when all slices are done.
+// Useful for exclusive systems that still have some embarassingly parallel work to do (ie, reading back physics state)
+// NOTE: if called from code that is already running in parallel, it just runs everything on the current thread
+void itu_sys_estorage_parallel_for(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count, ITU_SystemUpdateChunkFunction fn_update_chunk)
+{
+	if(itu_lib_jobs_is_inside_job() || entity_ids_count <= SYSTEM_CHUNK_SIZE_MIN)
+	{
+		fn_update_chunk(context, entity_ids, entity_ids_count);
 		return;
 	}
-	// TODO wrap tag list rendering in appropriate function
+
+	int jobs_count = itu_system_chunks_count(entity_ids_count);
+	ITU_Job*           jobs      = arena_alloc_array(&context->arena_frame, ITU_Job, jobs_count);
+	ITU_SystemJobData* jobs_data = arena_alloc_array(&context->arena_frame, ITU_SystemJobData, jobs_count);
+	// NOTE: chunks run as part of the calling system, so they see changes the same way
+	itu_system_jobs_add_chunks(jobs, jobs_data, context, entity_ids, entity_ids_count, fn_update_chunk, estorage_thread_last_run_version);
+	itu_lib_jobs_run(jobs, jobs_count);
+}
+
+void itu_weakrefs_refresh();
+
+void itu_sys_estorage_systems_update(SDLContext* context)
+{
+	// changes done outside of systems since the last update
+	itu_sys_estorage_observers_dispatch();
+
+	// NOTE: all structural changes requested by systems are deferred and applied at the end of each phase,
+	//       so entity lists never change while a system is iterating them
+	itu_sys_estorage_defer_begin();
+	for(int phase = 0; phase < ctx.systems_phases_count; ++phase)
 	{
-		ImGui::CollapsingHeader("tags", ImGuiTreeNodeFlags_Leaf);
-		int num_tags = 0;
-		for(int i = 0; i < TAGS_COUNT_MAX; ++i)
+		++ctx.world_version;
+
+		// entities destroyed by the previous phase (or before the update) must not be reachable from weak references
+		itu_weakrefs_refresh();
+
+		// NOTE: jobs only live until the end of the phase, they go in the frame arena
+		int jobs_count_max = 0;
+		for(int i = 0; i < ctx.systems_count; ++i)
 		{
-			if(stbds_hmgeti(ctx.tags[i], id) == -1)
+			ITU_System* system = &ctx.systems[i];
+			if(system->phase != phase || itu_system_is_exclusive(system))
 				continue;
 
-			++num_tags;
-			// TODO also wrap single tag (idx + name) rendering in appropriate function
-			int loc_tag_name = stbds_hmgeti(ctx.tag_debug_names, i);
-			if(loc_tag_name == -1)
-				ImGui::Text("%3d", i);
-			else
-				ImGui::Text("%3d: %s", i, ctx.tag_debug_names[loc_tag_name].value);
+			jobs_count_max += system->fn_update_chunk ? itu_system_chunks_count(stbds_arrlen(system->entity_ids)) : 1;
 		}
-		if(num_tags == 0)
-			ImGui::Text("none");
-	}
+		ITU_Job*           jobs      = arena_alloc_array(&context->arena_frame, ITU_Job, jobs_count_max);
+		ITU_SystemJobData* jobs_data = arena_alloc_array(&context->arena_frame, ITU_SystemJobData, jobs_count_max);
+		int jobs_count = 0;
 
-	for(int i = 0; i < ctx.components_count; ++i)
-	{
-		void* component_data = itu_entity_data_get(id, i);
+		for(int i = 0; i < ctx.systems_count; ++i)
+		{
+			ITU_System* system = &ctx.systems[i];
+			if(system->phase != phase)
+				continue;
 
-		if(!component_data)
-			continue;
+			if(system->fn_update_chunk)
+			{
+				jobs_count += itu_system_jobs_add_chunks(jobs + jobs_count, jobs_data + jobs_count, context, system->entity_ids, stbds_arrlen(system->entity_ids), system->fn_update_chunk, system->last_run_version);
+				continue;
+			}
 
-		ImGui::CollapsingHeader(ctx.components[i]->name, ImGuiTreeNodeFlags_Leaf);
-		{
-			if(ctx.components[i]->fn_debug_ui_render)
-				ctx.components[i]->fn_debug_ui_render(context, component_data);
-			else
-				ImGui::Text("TODO NotYetImplemented");
+			ITU_SystemJobData job_data;
+			job_data.context = context;
+			job_data.fn_update = system->fn_update;
+			job_data.entity_ids = system->entity_ids;
+			job_data.entity_ids_count = stbds_arrlen(system->entity_ids);
+			job_data.last_run_version = system->last_run_version;
+
+			if(itu_system_is_exclusive(system))
+			{
+				itu_system_run(&job_data);
+				continue;
+			}
+
+			jobs_data[jobs_count] = job_data;
+			jobs[jobs_count].fn = itu_system_job_update;
+			jobs[jobs_count].userdata = &jobs_data[jobs_count];
+			++jobs_count;
 		}
-	}
-}
 
-void itu_sys_estorage_debug_render_detail_system(SDLContext* context, ITU_System* system, ITU_EntityId* system_ids, int system_ids_count)
+		itu_lib_jobs_run(jobs, jobs_count);
+
+		for(int i = 0; i < ctx.systems_count; ++i)
+			if(ctx.systems[i].phase == phase)
+				ctx.systems[i].last_run_version = ctx.world_version;
+
+		// NOTE: components added by this phase need a newer version than the one its systems just ran at, or they would never see them
+		++ctx.world_version;
+
+		itu_sys_estorage_commands_flush();
+	}
+	itu_sys_estorage_defer_end();
+
+	// writes done outside of systems (until the next update) must be newer than the last phase
+	++ctx.world_version;
+
+	if(ctx.defer_depth == 0)
+		itu_sys_estorage_components_sort_update();
+}
+
+ITU_Query* itu_query_create(ITU_QueryDef query_def)
+{
+	ITU_Query* ret = (ITU_Query*)SDL_malloc(sizeof(ITU_Query));
+	SDL_zerop(ret);
+	ret->def = query_def;
+	ret->structural_version = ctx.structural_version - 1; // force a build the first time it's used
+
+	return ret;
+}
+
+void itu_query_destroy(ITU_Query* query)
+{
+	stbds_arrfree(query->archetypes);
+	stbds_arrfree(query->entity_ids);
+	SDL_free(query);
+}
+
+// rebuilds the cached results, if anything changed since the last time
+void itu_query_refresh(ITU_Query* query)
+{
+	ITU_Component* order_pool = itu_component_pool_order_get(query->def.with);
+	bool order_unchanged = order_pool == query->order_pool && (!order_pool || order_pool->order_version == query->order_version_pool);
+	if(query->structural_version == ctx.structural_version && order_unchanged)
+		return;
+
+	// NOTE: multiple jobs could be trying to rebuild the same query at the same time. Structural changes are always deferred
+	//       while systems run, so refreshing queries before running them is enough to never hit this
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+
+	ITU_QueryDef* def = &query->def;
+
+	// pick up archetypes created since the last time we checked
+	int archetypes_count = stbds_arrlen(ctx.archetypes);
+	for(int i = query->archetypes_checked_count; i < archetypes_count; ++i)
+	{
+		ITU_Mask archetype_mask = ctx.archetypes[i].component_mask;
+		if(itu_mask_contains(archetype_mask, def->with) && !itu_mask_intersects(archetype_mask, def->without))
+			stbds_arrput(query->archetypes, i);
+	}
+	query->archetypes_checked_count = archetypes_count;
+
+	bool filter_tags = !itu_mask_is_zero(def->tags_with) || !itu_mask_is_zero(def->tags_without);
+
+	stbds_arrsetlen(query->entity_ids, 0);
+
+	// every match has the component of `order_pool`, so walking that pool finds all of them, in the same order as the pools they are
+	// read from (see `itu_component_pool_order_get()`). It looks at entities that don't match too, but only once per rebuild
+	for(Uint32 i = 0; order_pool && i < order_pool->count_alive; ++i)
+	{
+		ITU_Entity* entity = &ctx.entities[order_pool->entity_ids[i].index];
+		if(!itu_mask_contains(entity->component_mask, def->with) || itu_mask_intersects(entity->component_mask, def->without))
+			continue;
+		if(filter_tags && (!itu_mask_contains(entity->tag_mask, def->tags_with) || itu_mask_intersects(entity->tag_mask, def->tags_without)))
+			continue;
+		stbds_arrput(query->entity_ids, entity->id);
+	}
+
+	// no required components, archetype by archetype
+	for(int i = 0; !order_pool && i < stbds_arrlen(query->archetypes); ++i)
+	{
+		ITU_Archetype* archetype = &ctx.archetypes[query->archetypes[i]];
+		int archetype_entities_count = stbds_arrlen(archetype->entity_ids);
+
+		if(!filter_tags)
+		{
+			SDL_memcpy(stbds_arraddnptr(query->entity_ids, archetype_entities_count), archetype->entity_ids, sizeof(ITU_EntityId) * archetype_entities_count);
+			continue;
+		}
+
+		for(int k = 0; k < archetype_entities_count; ++k)
+		{
+			ITU_EntityId id = archetype->entity_ids[k];
+			ITU_Mask tag_mask = ctx.entities[id.index].tag_mask;
+			if(itu_mask_contains(tag_mask, def->tags_with) && !itu_mask_intersects(tag_mask, def->tags_without))
+				stbds_arrput(query->entity_ids, id);
+		}
+	}
+
+	query->structural_version = ctx.structural_version;
+	query->order_pool = order_pool;
+	if(order_pool)
+		query->order_version_pool = order_pool->order_version;
+}
+
+// NOTE: the returned array is only valid until the next structural change, or until pools are reordered (end of `itu_sys_estorage_systems_update()`)
+ITU_EntityId* itu_query_get_entities(ITU_Query* query, int* out_count)
+{
+	itu_query_refresh(query);
+	*out_count = stbds_arrlen(query->entity_ids);
+	return query->entity_ids;
+}
+
+ITU_QueryIter itu_query_iter(ITU_Query* query)
+{
+	itu_query_refresh(query);
+
+	ITU_QueryIter ret;
+	ret.query = query;
+	ret.loc = -1;
+	ret.id = ITU_ENTITY_ID_NULL;
+	return ret;
+}
+
+bool itu_query_next(ITU_QueryIter* iter)
+{
+	if(++iter->loc >= stbds_arrlen(iter->query->entity_ids))
+		return false;
+
+	iter->id = iter->query->entity_ids[iter->loc];
+	return true;
+}
+
+// data of the given component for the current entity. NULL only if the component is optional and the entity doesn't have it
+// NOTE: required components skip all the checks done by `itu_entity_data_get()`, the query already guarantees they are there
+void* itu_query_iter_data_get(ITU_QueryIter* iter, ITU_ComponentType component_type)
+{
+	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
+	ITU_EntityId id = iter->id;
+
+	if(!itu_mask_test(iter->query->def.with, component_type))
+	{
+		SDL_assert(itu_mask_test(iter->query->def.optional, component_type));
+		if(!itu_mask_test(ctx.entities[id.index].component_mask, component_type))
+			return NULL;
+	}
+
+	ITU_Component* component = ctx.components[component_type];
+	Uint32 loc = component->data_loc_pages[id.index >> COMPONENT_PAGE_SHIFT][id.index & (COMPONENT_PAGE_SIZE - 1)];
+	return pointer_index(component->data, loc, component->element_size);
+}
+
+enum ITU_SysEstorageDebugDetailCategory { ITU_SYS_ESTORAGE_DETAIL_CATEGORY_ENTITY, ITU_SYS_ESTORAGE_DETAIL_CATEGORY_SYSTEM, ITU_SYS_ESTORAGE_DETAIL_CATEGORY_QUERY, ITU_SYS_ESTORAGE_DETAIL_CATEGORY_MAX };
+
+void itu_sys_estorage_debug_render_detail_entity(SDLContext* context, ITU_EntityId id)
+{
+	if(!itu_entity_is_valid(id))
+	{
+		ImGui::Text("INVALID ENTITY");
+		return;
+	}
+	// TODO wrap tag list rendering in appropriate function
+	{
+		ImGui::CollapsingHeader("tags", ImGuiTreeNodeFlags_Leaf);
+		int num_tags = 0;
+		for(int i = 0; i < TAGS_COUNT_MAX; ++i)
+		{
+			if(!itu_entity_tag_has(id, i))
+				continue;
+
+			++num_tags;
+			// TODO also wrap single tag (idx + name) rendering in appropriate function
+			int loc_tag_name = stbds_hmgeti(ctx.tag_debug_names, i);
+			if(loc_tag_name == -1)
+				ImGui::Text("%3d", i);
+			else
+				ImGui::Text("%3d: %s", i, ctx.tag_debug_names[loc_tag_name].value);
+		}
+		if(num_tags == 0)
+			ImGui::Text("none");
+	}
+
+	{
+		ImGui::CollapsingHeader("relations", ImGuiTreeNodeFlags_Leaf);
+		int num_relations = 0;
+		for(int i = 0; i < RELATIONS_COUNT_MAX; ++i)
+		{
+			ITU_EntityId target = itu_entity_relation_get(id, i);
+			if(!itu_entity_is_valid(target))
+				continue;
+
+			++num_relations;
+			char label[32];
+			if(ctx.relations[i].debug_name)
+				SDL_snprintf(label, 32, "%3d: %s", i, ctx.relations[i].debug_name);
+			else
+				SDL_snprintf(label, 32, "%3d", i);
+			itu_debug_ui_widget_entityid(label, target);
+		}
+		if(num_relations == 0)
+			ImGui::Text("none");
+	}
+
+	for(int i = 0; i < ctx.components_count; ++i)
+	{
+		// NOTE: anything can be edited from here, so it counts as a write
+		void* component_data = itu_entity_data_get_mut(id, i);
+
+		if(!component_data)
+			continue;
+
+		ImGui::CollapsingHeader(ctx.components[i]->name, ImGuiTreeNodeFlags_Leaf);
+		{
+			if(ctx.components[i]->fn_debug_ui_render)
+				ctx.components[i]->fn_debug_ui_render(context, component_data);
+			else
+				ImGui::Text("TODO NotYetImplemented");
+		}
+	}
+}
+
+void itu_sys_estorage_debug_render_detail_system(SDLContext* context, ITU_System* system, ITU_EntityId* system_ids, int system_ids_count)
 {
 	ImGui::CollapsingHeader("components", ImGuiTreeNodeFlags_Leaf);
 	for(int i = 0; i < system->components_count; ++i)
@@ -372,13 +1141,28 @@ void itu_sys_estorage_debug_render_detail_system(SDLContext* context, ITU_System
 	ImGui::PopStyleVar();
 }
 
+void itu_sys_estorage_debug_render_detail_query(SDLContext* context, ITU_Query* query)
+{
+	int query_ids_count;
+	ITU_EntityId* query_ids = itu_query_get_entities(query, &query_ids_count);
+
+	ImGui::CollapsingHeader("matching entities", ImGuiTreeNodeFlags_Leaf);
+	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
+	for(int i = 0; i < query_ids_count; ++i)
+	{
+		char buf[8];
+		SDL_snprintf(buf, 8, "%d", i);
+		itu_debug_ui_widget_entityid((char*)buf, query_ids[i]);
+	}
+	ImGui::PopStyleVar();
+}
+
 void itu_sys_estorage_debug_render(SDLContext* context)
 {
 	static ITU_SysEstorageDebugDetailCategory detail_category = ITU_SYS_ESTORAGE_DETAIL_CATEGORY_MAX;
 	static int loc_selected = -1;
-
-	ITU_EntityId selected_system_ids[ENTITIES_COUNT_MAX];
-	int selected_system_ids_count;
+	static ITU_QueryDef debug_query_def = { 0 };
+	static ITU_Query* debug_query = NULL;
 
 	ImGui::Begin("debug_estorage", NULL, ImGuiWindowFlags_NoCollapse);
 	ImGui::SameLine();
@@ -444,15 +1228,47 @@ void itu_sys_estorage_debug_render(SDLContext* context)
 			}
 		}
 
+		if(ImGui::CollapsingHeader("Archetypes"))
+		{
+			if(ImGui::BeginTable("debug_estorage_master_archetypes", 3, ImGuiTableFlags_SizingFixedFit))
+			{
+				ImGui::TableSetupColumn("");
+				ImGui::TableSetupColumn("signature");
+				ImGui::TableSetupColumn("entities");
+				ImGui::TableHeadersRow();
+				for(int i = 0; i < stbds_arrlen(ctx.archetypes); ++i)
+				{
+					ITU_Archetype* archetype = &ctx.archetypes[i];
+					ImGui::TableNextRow();
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%3d", i);
+
+					ImGui::TableNextColumn();
+					// most significant word first, so it reads as a single big number
+					char buf_signature[ITU_MASK_WORDS * 16 + 1];
+					for(int w = 0; w < ITU_MASK_WORDS; ++w)
+						SDL_snprintf(buf_signature + w * 16, 17, "%016llx", (unsigned long long)archetype->component_mask.words[ITU_MASK_WORDS - 1 - w]);
+					ImGui::Text("%s", buf_signature);
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%d", (int)stbds_arrlen(archetype->entity_ids));
+				}
+
+				ImGui::EndTable();
+			}
+		}
+
 		if(ImGui::CollapsingHeader("Systems", ImGuiTreeNodeFlags_DefaultOpen))
 		{
-			if(ImGui::BeginTable("debug_estorage_master_systems", 5, ImGuiTableFlags_SizingFixedFit))
+			if(ImGui::BeginTable("debug_estorage_master_systems", 6, ImGuiTableFlags_SizingFixedFit))
 			{
 				ImGui::TableSetupColumn("");
 				ImGui::TableSetupColumn("name");
 				ImGui::TableSetupColumn("comp");
 				ImGui::TableSetupColumn("tags");
 				ImGui::TableSetupColumn("entities");
+				ImGui::TableSetupColumn("phase");
 				ImGui::TableHeadersRow();
 				for(int i = 0; i < ctx.systems_count; ++i)
 				{
@@ -482,29 +1298,77 @@ void itu_sys_estorage_debug_render(SDLContext* context)
 					ImGui::Text("%d", system->tags_count);
 
 					ImGui::TableNextColumn();
-					ITU_EntityId scratch_system_ids[ENTITIES_COUNT_MAX];
-					int scratch_system_ids_count;
-
-					ITU_EntityId* system_ids;
-					int* system_ids_count;
+					ImGui::Text("%d", (int)stbds_arrlen(system->entity_ids));
 
-					if(detail_category == ITU_SYS_ESTORAGE_DETAIL_CATEGORY_SYSTEM && i == loc_selected)
-					{
-						system_ids = selected_system_ids;
-						system_ids_count = &selected_system_ids_count;
-					}
+					ImGui::TableNextColumn();
+					if(itu_system_is_exclusive(system))
+						ImGui::Text("%d (excl.)", system->phase);
 					else
+						ImGui::Text("%d", system->phase);
+				}
+
+				ImGui::EndTable();
+			}
+		}
+
+		if(ImGui::CollapsingHeader("Query"))
+		{
+			bool query_changed = false;
+			if(ImGui::BeginTable("debug_estorage_master_query", 4, ImGuiTableFlags_SizingFixedFit))
+			{
+				ImGui::TableSetupColumn("component");
+				ImGui::TableSetupColumn("with");
+				ImGui::TableSetupColumn("without");
+				ImGui::TableSetupColumn("opt.");
+				ImGui::TableHeadersRow();
+				for(int i = 0; i < ctx.components_count; ++i)
+				{
+					ImGui::PushID(i);
+					ImGui::TableNextRow();
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%s", ctx.components[i]->name);
+
+					ITU_Mask* masks[3] = { &debug_query_def.with, &debug_query_def.without, &debug_query_def.optional };
+					for(int j = 0; j < 3; ++j)
 					{
-						system_ids = scratch_system_ids;
-						system_ids_count = &scratch_system_ids_count;
+						ImGui::TableNextColumn();
+						ImGui::PushID(j);
+						bool value = itu_mask_test(*masks[j], i);
+						if(ImGui::Checkbox("", &value))
+						{
+							// a component can only be in one of the lists at a time
+							for(int k = 0; k < 3; ++k)
+								*masks[k] &= ~itu_mask_bit(i);
+							if(value)
+								*masks[j] |= itu_mask_bit(i);
+							query_changed = true;
+						}
+						ImGui::PopID();
 					}
-
-					*system_ids_count = itu_system_get_matching_entities(system, system_ids);
-					ImGui::Text("%d", *system_ids_count);
+					ImGui::PopID();
 				}
 
 				ImGui::EndTable();
 			}
+
+			if(query_changed && debug_query)
+			{
+				itu_query_destroy(debug_query);
+				debug_query = NULL;
+			}
+			if(!debug_query)
+				debug_query = itu_query_create(debug_query_def);
+
+			int query_ids_count;
+			itu_query_get_entities(debug_query, &query_ids_count);
+			char buf_query[48];
+			SDL_snprintf(buf_query, 48, "%d matching##debug_estorage_master_query", query_ids_count);
+			if(ImGui::Selectable(buf_query, detail_category == ITU_SYS_ESTORAGE_DETAIL_CATEGORY_QUERY))
+			{
+				loc_selected = 0;
+				detail_category = ITU_SYS_ESTORAGE_DETAIL_CATEGORY_QUERY;
+			}
 		}
 		ImGui::EndChild();
 	}
@@ -516,7 +1380,18 @@ void itu_sys_estorage_debug_render(SDLContext* context)
 			switch(detail_category)
 			{
 				case ITU_SYS_ESTORAGE_DETAIL_CATEGORY_ENTITY: itu_sys_estorage_debug_render_detail_entity(context, ctx.entities[loc_selected].id); break;
-				case ITU_SYS_ESTORAGE_DETAIL_CATEGORY_SYSTEM: itu_sys_estorage_debug_render_detail_system(context, &ctx.systems[loc_selected], selected_system_ids, selected_system_ids_count); break;
+				case ITU_SYS_ESTORAGE_DETAIL_CATEGORY_SYSTEM:
+				{
+					ITU_System* system = &ctx.systems[loc_selected];
+					itu_sys_estorage_debug_render_detail_system(context, system, system->entity_ids, stbds_arrlen(system->entity_ids));
+					break;
+				}
+				case ITU_SYS_ESTORAGE_DETAIL_CATEGORY_QUERY:
+				{
+					if(debug_query)
+						itu_sys_estorage_debug_render_detail_query(context, debug_query);
+					break;
+				}
 				default: /* do nothing */ break;
 			}
 		ImGui::EndChild();
@@ -530,24 +1405,109 @@ void itu_sys_estorage_tag_set_debug_name(int tag, const char* tag_debug_name)
 	stbds_hmput(ctx.tag_debug_names, tag, tag_debug_name);
 }
 
+// returns the archetype with the given signature, creating it if it doesn't exist yet
+int itu_archetype_get(ITU_Mask component_mask)
+{
+	int loc = stbds_hmgeti(ctx.archetypes_lookup, component_mask);
+	if(loc != -1)
+		return ctx.archetypes_lookup[loc].value;
+
+	ITU_Archetype archetype;
+	archetype.component_mask = component_mask;
+	archetype.entity_ids = NULL;
+
+	int ret = stbds_arrlen(ctx.archetypes);
+	stbds_arrput(ctx.archetypes, archetype);
+	stbds_hmput(ctx.archetypes_lookup, component_mask, ret);
+
+	return ret;
+}
+
+void itu_archetype_entity_add(int archetype_idx, ITU_EntityId id)
+{
+	ITU_Archetype* archetype = &ctx.archetypes[archetype_idx];
+	ITU_Entity* entity = &ctx.entities[id.index];
+
+	entity->archetype = archetype_idx;
+	entity->archetype_loc = stbds_arrlen(archetype->entity_ids);
+	stbds_arrput(archetype->entity_ids, id);
+}
+
+void itu_archetype_entity_remove(ITU_EntityId id)
+{
+	ITU_Entity* entity = &ctx.entities[id.index];
+	ITU_Archetype* archetype = &ctx.archetypes[entity->archetype];
+
+	// swap-remove, fixing up the location of the entity we moved
+	int loc_curr = entity->archetype_loc;
+	int loc_last = stbds_arrlen(archetype->entity_ids) - 1;
+	ITU_EntityId id_last = archetype->entity_ids[loc_last];
+	archetype->entity_ids[loc_curr] = id_last;
+	ctx.entities[id_last.index].archetype_loc = loc_curr;
+	stbds_arrpop(archetype->entity_ids);
+
+	entity->archetype = -1;
+	entity->archetype_loc = -1;
+}
+
 void itu_component_pool_assign(ITU_Component* component_pool, ITU_EntityId entity)
 {
 	SDL_assert(component_pool);
-	SDL_assert(component_pool->count_alive < component_pool->count_max);
+	SDL_assert(itu_component_pool_loc_get(component_pool, entity.index) == COMPONENT_LOC_NONE);
 
-	// TODO check that requested entry is actually free
+	itu_component_pool_reserve(component_pool, component_pool->count_alive + 1);
 
 	Uint64 i = component_pool->count_alive++;
-	component_pool->data_loc[entity.index] = i;
+	component_pool->order_version++;
+	itu_component_pool_loc_set(component_pool, entity.index, i);
 	component_pool->entity_ids[i] = entity;
+	component_pool->versions[i] = ctx.world_version;
 	SDL_memset((unsigned char*)component_pool->data + component_pool->element_size * i, 0, component_pool->element_size);
 }
 
+// assigns one slot to each of the given entities, all initialized to `in_data_copy` (zero if NULL).
+// Slots are contiguous, so the data is filled with a handful of memcpys doubling in size, instead of one copy per entity
+void itu_component_pool_assign_many(ITU_Component* component_pool, ITU_EntityId* entities, int entities_count, void* in_data_copy)
+{
+	SDL_assert(component_pool);
+
+	if(entities_count == 0)
+		return;
+
+	itu_component_pool_reserve(component_pool, component_pool->count_alive + entities_count);
+
+	Uint64 first = component_pool->count_alive;
+	component_pool->count_alive += entities_count;
+	component_pool->order_version++;
+	for(int i = 0; i < entities_count; ++i)
+	{
+		itu_component_pool_loc_set(component_pool, entities[i].index, first + i);
+		component_pool->entity_ids[first + i] = entities[i];
+		component_pool->versions[first + i] = ctx.world_version;
+	}
+
+	Uint64 element_size = component_pool->element_size;
+	unsigned char* data = (unsigned char*)pointer_index(component_pool->data, first, element_size);
+	if(!in_data_copy)
+	{
+		SDL_memset(data, 0, element_size * entities_count);
+		return;
+	}
+
+	SDL_memcpy(data, in_data_copy, element_size);
+	for(int copied = 1; copied < entities_count; )
+	{
+		int copy_count = SDL_min(copied, entities_count - copied);
+		SDL_memcpy(data + element_size * copied, data, element_size * copy_count);
+		copied += copy_count;
+	}
+}
+
 void itu_component_pool_data_get(ITU_Component* component_pool, ITU_EntityId entity, void* out_data_copy)
 {
 	SDL_assert(component_pool);
 
-	Uint64 loc = component_pool->data_loc[entity.index];
+	Uint64 loc = itu_component_pool_loc_get(component_pool, entity.index);
 	void* data = pointer_offset(void, component_pool->data, component_pool->element_size * loc);
 	SDL_memcpy(out_data_copy, data, component_pool->element_size);
 }
@@ -556,7 +1516,7 @@ void itu_component_pool_data_set(ITU_Component* component_pool, ITU_EntityId ent
 {
 	SDL_assert(component_pool);
 
-	Uint64 loc = component_pool->data_loc[entity.index];
+	Uint64 loc = itu_component_pool_loc_get(component_pool, entity.index);
 	void* data = pointer_offset(void, component_pool->data, component_pool->element_size * loc);
 	SDL_memcpy(data, in_data_copy, component_pool->element_size);
 }
@@ -564,223 +1524,2093 @@ void itu_component_pool_data_set(ITU_Component* component_pool, ITU_EntityId ent
 void itu_component_pool_remove(ITU_Component* component_pool, ITU_EntityId entity)
 {
 	SDL_assert(component_pool);
-	SDL_assert(component_pool->data_loc[entity.index] != -1);
+	SDL_assert(itu_component_pool_loc_get(component_pool, entity.index) != COMPONENT_LOC_NONE);
 
-	Uint64 loc_curr = entity.index;
+	Uint64 loc_curr = itu_component_pool_loc_get(component_pool, entity.index);
 	Uint64 loc_last = component_pool->count_alive - 1;
-	component_pool->entity_ids[loc_curr] = component_pool->entity_ids[loc_last];
+	ITU_EntityId entity_last = component_pool->entity_ids[loc_last];
+	component_pool->entity_ids[loc_curr] = entity_last;
+	component_pool->versions[loc_curr] = component_pool->versions[loc_last];
+	itu_component_pool_loc_set(component_pool, entity_last.index, loc_curr);
+	itu_component_pool_loc_set(component_pool, entity.index, COMPONENT_LOC_NONE);
 
 	void* ptr_curr = pointer_offset(void, component_pool->data, loc_curr * component_pool->element_size);
 	void* ptr_last = pointer_offset(void, component_pool->data, loc_last * component_pool->element_size);
 	SDL_memcpy(ptr_curr, ptr_last, component_pool->element_size);
 
 	component_pool->count_alive--;
+	component_pool->order_version++;
 }
 
 void itu_component_pool_clear(ITU_Component* component_pool)
 {
 	SDL_assert(component_pool);
 
+	// NOTE: dense arrays keep their capacity (they'll most likely be filled again), but the lookup pages
+	//       depend on which entities had the component, so we give them back
+	for(int i = 0; i < stbds_arrlen(component_pool->data_loc_pages); ++i)
+		SDL_free(component_pool->data_loc_pages[i]);
+	stbds_arrfree(component_pool->data_loc_pages);
+
 	component_pool->count_alive = 0;
+	component_pool->order_version++;
+	component_pool->sort_cursor = 0;
+	component_pool->sort_cursor_dst = 0;
+	component_pool->sort_gap = 0;
+	component_pool->sort_pass_swaps = 0;
 }
 
+// swaps two elements of the dense arrays, keeping the lookup in sync
+void itu_component_pool_swap(ITU_Component* component_pool, Uint32 loc_a, Uint32 loc_b)
+{
+	if(loc_a == loc_b)
+		return;
 
-ITU_EntityId itu_entity_create()
+	ITU_EntityId id_a = component_pool->entity_ids[loc_a];
+	ITU_EntityId id_b = component_pool->entity_ids[loc_b];
+	component_pool->entity_ids[loc_a] = id_b;
+	component_pool->entity_ids[loc_b] = id_a;
+	itu_component_pool_loc_set(component_pool, id_a.index, loc_b);
+	itu_component_pool_loc_set(component_pool, id_b.index, loc_a);
+
+	Uint32 version_a = component_pool->versions[loc_a];
+	component_pool->versions[loc_a] = component_pool->versions[loc_b];
+	component_pool->versions[loc_b] = version_a;
+
+	// NOTE: element size is only known at runtime, so we go through a small buffer
+	Uint64 element_size = component_pool->element_size;
+	unsigned char* ptr_a = pointer_index(component_pool->data, loc_a, element_size);
+	unsigned char* ptr_b = pointer_index(component_pool->data, loc_b, element_size);
+	unsigned char tmp[64];
+	for(Uint64 offset = 0; offset < element_size; offset += sizeof(tmp))
+	{
+		Uint64 size = SDL_min(sizeof(tmp), element_size - offset);
+		SDL_memcpy(tmp, ptr_a + offset, size);
+		SDL_memcpy(ptr_a + offset, ptr_b + offset, size);
+		SDL_memcpy(ptr_b + offset, tmp, size);
+	}
+
+	component_pool->order_version++;
+}
+
+// walks the primary pool in order, moving the entities that have this component too to the front of this pool, in the same order.
+// A pass can span multiple frames. Structural changes in between can leave a few elements out of place, they are fixed by the next pass
+void itu_component_pool_sort_align_steps(ITU_Component* component_pool, int steps)
 {
-	if(stbds_arrlen(ctx.entities_free) > 0)
+	ITU_Component* primary = component_pool->sort_primary;
+
+	bool unchanged = component_pool->order_version == component_pool->sort_version && primary->order_version == component_pool->sort_version_primary;
+	if(component_pool->sort_clean && unchanged)
+		return;
+
+	if(component_pool->sort_cursor == 0)
 	{
-		ITU_EntityId id_recycled = stbds_arrpop(ctx.entities_free);
-		ctx.entities[id_recycled.index].id.index = id_recycled.index;
-		ctx.entities[id_recycled.index].id.generation = id_recycled.generation + 1;
-		return ctx.entities[id_recycled.index].id;
+		component_pool->sort_version = component_pool->order_version;
+		component_pool->sort_version_primary = primary->order_version;
 	}
 
-	ITU_Entity entity_data;
-	entity_data.id.generation = 0;
-	entity_data.id.index = stbds_arrlen(ctx.entities);
-	entity_data.component_mask = 0;
-	stbds_arrput(ctx.entities, entity_data);
+	for(int i = 0; i < steps; ++i)
+	{
+		if(component_pool->sort_cursor >= primary->count_alive || component_pool->sort_cursor_dst >= component_pool->count_alive)
+		{
+			// NOTE: if nothing moved during the whole pass, everything is in place already and we can stop
+			//       until one of the two pools changes again
+			component_pool->sort_clean = component_pool->order_version == component_pool->sort_version && primary->order_version == component_pool->sort_version_primary;
+			component_pool->sort_cursor = 0;
+			component_pool->sort_cursor_dst = 0;
+			return;
+		}
+
+		ITU_EntityId id = primary->entity_ids[component_pool->sort_cursor++];
+		Uint32 loc = itu_component_pool_loc_get(component_pool, id.index);
+		if(loc == COMPONENT_LOC_NONE)
+			continue;
 
-	return entity_data.id;
+		itu_component_pool_swap(component_pool, loc, component_pool->sort_cursor_dst++);
+	}
 }
 
-void  itu_entity_set_debug_name(ITU_EntityId id, const char* debug_name)
+// comb sort: it can stop and resume anywhere, and once the gap is down to 1 it's just bubble sort passes,
+// linear on (almost) sorted data, which is the common case since keys don't change much from frame to frame.
+// When a lot of elements turn out to be out of place, it starts again from a wide gap, so that they move into place in big jumps
+// NOTE: keys can change at any time without the pool knowing, so passes never stop for good (only for the rest of the frame)
+void itu_component_pool_sort_key_steps(ITU_Component* component_pool, int steps)
 {
-	// NOTE: allocating every single name is BAD, but we haven't looked in allocaiton startegies and memory arenas yet
-	int len = SDL_strlen(debug_name);
-	char* name_storage = (char*)SDL_malloc(len + 1);
-	SDL_memcpy(name_storage, debug_name, len);
-	name_storage[len] = 0;
+	Uint64 element_size = component_pool->element_size;
+	Uint32 count = component_pool->count_alive;
+	if(count < 2)
+		return;
 
-	stbds_hmput(ctx.entities_debug_names, id, name_storage);
+	if(component_pool->sort_gap == 0)
+		component_pool->sort_gap = SDL_max(count * 10 / 13, 1);
+
+	for(int i = 0; i < steps; ++i)
+	{
+		Uint32 gap = component_pool->sort_gap;
+		Uint32 loc = component_pool->sort_cursor;
+		if(loc + gap >= count)
+		{
+			bool sorted = gap == 1 && component_pool->sort_pass_swaps == 0;
+			if(gap > 1)
+				component_pool->sort_gap = SDL_max(gap * 10 / 13, 1);
+			else if(component_pool->sort_pass_swaps > count / 16)
+				component_pool->sort_gap = SDL_max(count * 10 / 13, 1);
+			component_pool->sort_cursor = 0;
+			component_pool->sort_pass_swaps = 0;
+
+			if(sorted)
+				return;
+			continue;
+		}
+
+		Uint64 key_a = component_pool->fn_sort_key(pointer_index(component_pool->data, loc, element_size));
+		Uint64 key_b = component_pool->fn_sort_key(pointer_index(component_pool->data, loc + gap, element_size));
+		if(key_b < key_a)
+		{
+			itu_component_pool_swap(component_pool, loc, loc + gap);
+			component_pool->sort_pass_swaps++;
+		}
+		component_pool->sort_cursor = loc + 1;
+	}
 }
 
-bool itu_entity_equals(ITU_EntityId a, ITU_EntityId b)
+// true if the pool follows another one, or another one follows it
+bool itu_component_pool_is_aligned(ITU_Component* component_pool)
 {
-	return a.generation == b.generation && a.generation == b.generation;
+	if(component_pool->sort_primary)
+		return true;
+	for(int i = 0; i < ctx.components_count; ++i)
+		if(ctx.components[i]->sort_primary == component_pool)
+			return true;
+	return false;
 }
 
-bool itu_entity_is_valid(ITU_EntityId id)
+// pool whose order entities with all the components in `component_mask` are iterated in (NULL if the mask is empty).
+// Pools aligned to each other all end up in the order of the same primary, so any of them works. The first one in the mask
+// that is part of an alignment is picked, so that iterating in its order walks all the aligned pools linearly at once
+ITU_Component* itu_component_pool_order_get(ITU_Mask component_mask)
 {
-	return id.index != -1 && ctx.entities[id.index].id.generation == id.generation;
+	ITU_Component* ret = NULL;
+	for(int i = 0; i < ctx.components_count; ++i)
+	{
+		if(!itu_mask_test(component_mask, i))
+			continue;
+		if(itu_component_pool_is_aligned(ctx.components[i]))
+			return ctx.components[i];
+		if(!ret)
+			ret = ctx.components[i];
+	}
+	return ret;
 }
 
-void itu_entity_id_to_stringid(ITU_EntityId id, char* buffer, int max_len)
+void itu_system_swap(ITU_System* system, int loc_a, int loc_b)
 {
-	// NOTE: this is super slow, but we have to do this if we want to leverage imgui for out UI toolkit
-	SDL_snprintf(buffer, max_len, "%d-%d", id.generation, id.index);
+	if(loc_a == loc_b)
+		return;
+
+	ITU_EntityId id_a = system->entity_ids[loc_a];
+	ITU_EntityId id_b = system->entity_ids[loc_b];
+	system->entity_ids[loc_a] = id_b;
+	system->entity_ids[loc_b] = id_a;
+	system->entity_locs[id_a.index] = loc_b;
+	system->entity_locs[id_b.index] = loc_a;
+	system->order_version++;
 }
 
-// `in_data_copy`: default component init. Can be null
-void itu_entity_component_add(ITU_EntityId id, ITU_ComponentType component_type, void* in_data_copy)
+// same as `itu_component_pool_sort_align_steps()`, for the list of entities of a system
+// NOTE: every entity of the system has the component of `order_pool`, so at the end of a pass they are all in its order
+void itu_system_sort_align_steps(ITU_System* system, int steps)
 {
-	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
-	Uint64 component_bit = 1ll << component_type;
+	ITU_Component* order_pool = system->order_pool;
+
+	bool unchanged = system->order_version == system->sort_version && order_pool->order_version == system->sort_version_pool;
+	if(system->sort_clean && unchanged)
+		return;
+
+	if(system->sort_cursor == 0)
+	{
+		system->sort_version = system->order_version;
+		system->sort_version_pool = order_pool->order_version;
+	}
+
+	Uint32 entities_count = stbds_arrlen(system->entity_ids);
+	for(int i = 0; i < steps; ++i)
+	{
+		if(system->sort_cursor >= order_pool->count_alive || system->sort_cursor_dst >= entities_count)
+		{
+			system->sort_clean = system->order_version == system->sort_version && order_pool->order_version == system->sort_version_pool;
+			system->sort_cursor = 0;
+			system->sort_cursor_dst = 0;
+			return;
+		}
+
+		ITU_EntityId id = order_pool->entity_ids[system->sort_cursor++];
+		if(!itu_system_entity_has(system, id))
+			continue;
+
+		itu_system_swap(system, system->entity_locs[id.index], system->sort_cursor_dst++);
+	}
+}
+
+// does a bounded amount of sorting work on every pool that asked for it, and on the entity lists of systems.
+// Called at the end of `itu_sys_estorage_systems_update()`, when no system is running and all structural changes have been applied
+void itu_sys_estorage_components_sort_update()
+{
+	SDL_assert(ctx.defer_depth == 0);
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+
+	for(int i = 0; i < ctx.components_count; ++i)
+	{
+		ITU_Component* component_pool = ctx.components[i];
+		if(component_pool->sort_primary)
+			itu_component_pool_sort_align_steps(component_pool, component_pool->sort_steps_per_frame);
+		else if(component_pool->fn_sort_key)
+			itu_component_pool_sort_key_steps(component_pool, component_pool->sort_steps_per_frame);
+	}
+
+	// systems follow the pools, so that walking their entity lists walks the pools linearly too
+	// NOTE: queries do the same, but they are rebuilt from scratch anyway (see `itu_query_refresh()`)
+	for(int i = 0; i < ctx.systems_count; ++i)
+	{
+		ITU_System* system = &ctx.systems[i];
+		ITU_Component* order_pool = itu_component_pool_order_get(system->component_mask);
+		if(order_pool != system->order_pool)
+		{
+			system->order_pool = order_pool;
+			system->sort_cursor = 0;
+			system->sort_cursor_dst = 0;
+			system->sort_clean = false;
+		}
+		if(order_pool)
+			itu_system_sort_align_steps(system, COMPONENT_SORT_STEPS_DEFAULT);
+	}
+}
+
+
+// appends a command to the current thread's buffer, returning a pointer to its payload
+void* itu_command_record(ITU_CommandType type, ITU_EntityId id, Uint8 arg, Uint32 payload_size)
+{
+	stbds_arr(Uint8)* buffer = &ctx.commands[itu_lib_jobs_get_thread_index()];
+	Uint32 payload_size_aligned = (payload_size + 7) & ~7;
+
+	ITU_Command* command = (ITU_Command*)stbds_arraddnptr(*buffer, sizeof(ITU_Command) + payload_size_aligned);
+	command->id = id;
+	command->payload_size = payload_size_aligned;
+	command->type = type;
+	command->arg = arg;
+
+	return command + 1;
+}
+
+// picks the id the next created entity will use (recycling a free slot if possible)
+// NOTE: when deferring, the new slot is only reserved, it will be set up by `itu_sys_estorage_commands_flush()`
+ITU_EntityId itu_entity_id_next()
+{
+	ITU_EntityId ret;
+	if(stbds_arrlen(ctx.entities_free) > 0)
+	{
+		ITU_EntityId id_recycled = stbds_arrpop(ctx.entities_free);
+		ret.index = id_recycled.index;
+		ret.generation = id_recycled.generation + 1;
+	}
+	else
+	{
+		ret.index = SDL_max(ctx.entities_index_next, (Uint32)stbds_arrlen(ctx.entities));
+		ret.generation = 0;
+		ctx.entities_index_next = ret.index + 1;
+	}
+
+	return ret;
+}
+
+// makes sure there is a slot for the given entity index
+// NOTE: deferred creates can be played back in any order, so we might have to grow past some slots that are still reserved.
+//       They stay dead until their own create is played back
+void itu_entities_grow(Uint32 index)
+{
+	int entities_count = stbds_arrlen(ctx.entities);
+	if(index >= entities_count)
+	{
+		stbds_arrsetlen(ctx.entities, index + 1);
+		for(int i = entities_count; i <= index; ++i)
+		{
+			ITU_Entity* entity = &ctx.entities[i];
+			entity->id.generation = 0;
+			entity->id.index = -1;
+			entity->component_mask = 0;
+			entity->tag_mask = 0;
+			entity->archetype = -1;
+			entity->archetype_loc = -1;
+		}
+	}
+}
+
+void itu_entity_create_at(ITU_EntityId id)
+{
+	itu_entities_grow(id.index);
+
+	ITU_Entity* entity = &ctx.entities[id.index];
+	entity->id = id;
+	entity->component_mask = 0;
+	entity->tag_mask = 0;
+	itu_archetype_entity_add(0, id);
+	itu_systems_entity_refresh(id);
+}
+
+// NOTE: while deferring, the returned id is reserved but the entity doesn't exist yet (`itu_entity_is_valid()` returns false).
+//       Components and tags can still be added to it, they will be applied right after the entity is created
+ITU_EntityId itu_entity_create()
+{
+	if(ctx.defer_depth > 0)
+	{
+		SDL_LockMutex(ctx.entities_reserve_mutex);
+		ITU_EntityId id = itu_entity_id_next();
+		SDL_UnlockMutex(ctx.entities_reserve_mutex);
+
+		itu_command_record(ITU_COMMAND_ENTITY_CREATE, id, 0, 0);
+		return id;
+	}
+
+	ITU_EntityId id = itu_entity_id_next();
+	itu_entity_create_at(id);
+
+	return id;
+}
+
+// creates all the given entities with the prefab's signature (or empty, if `prefab` is NULL), touching each
+// archetype, pool, tag and system only once for the whole batch
+void itu_entities_instantiate_at(ITU_Prefab* prefab, ITU_EntityId* ids, int count)
+{
+	if(count == 0)
+		return;
+
+	++ctx.structural_version;
+
+	ITU_Mask component_mask = prefab ? prefab->component_mask : 0;
+	ITU_Mask tag_mask       = prefab ? prefab->tag_mask       : 0;
+
+	// ids are sorted by index only if nothing was recycled, so grow up to the biggest one
+	Uint32 index_max = 0;
+	for(int i = 0; i < count; ++i)
+		index_max = SDL_max(index_max, ids[i].index);
+	itu_entities_grow(index_max);
+
+	int archetype_idx = itu_archetype_get(component_mask);
+	ITU_Archetype* archetype = &ctx.archetypes[archetype_idx];
+	int archetype_loc_first = stbds_arrlen(archetype->entity_ids);
+	SDL_memcpy(stbds_arraddnptr(archetype->entity_ids, count), ids, sizeof(ITU_EntityId) * count);
+
+	for(int i = 0; i < count; ++i)
+	{
+		ITU_Entity* entity = &ctx.entities[ids[i].index];
+		entity->id = ids[i];
+		entity->component_mask = component_mask;
+		entity->tag_mask = tag_mask;
+		entity->archetype = archetype_idx;
+		entity->archetype_loc = archetype_loc_first + i;
+	}
+
+	for(int i = 0; i < ctx.components_count; ++i)
+	{
+		if(!itu_mask_test(component_mask, i))
+			continue;
+		itu_component_pool_assign_many(ctx.components[i], ids, count, prefab->component_defaults[i]);
+		itu_observers_queue(ITU_OBSERVER_ON_ADD, i, ids, count);
+	}
+
+	for(int i = 0; i < TAGS_COUNT_MAX; ++i)
+	{
+		if(!itu_mask_test(tag_mask, i))
+			continue;
+
+		ITU_Tag* tag_storage = &ctx.tags[i];
+		if(index_max >= stbds_arrlen(tag_storage->entity_locs))
+			stbds_arrsetlen(tag_storage->entity_locs, index_max + 1);
+		int tag_loc_first = stbds_arrlen(tag_storage->entity_ids);
+		SDL_memcpy(stbds_arraddnptr(tag_storage->entity_ids, count), ids, sizeof(ITU_EntityId) * count);
+		for(int j = 0; j < count; ++j)
+			tag_storage->entity_locs[ids[j].index] = tag_loc_first + j;
+	}
+
+	// all entities share the same signature, so we only need to check each system once
+	for(int i = 0; i < ctx.systems_count; ++i)
+	{
+		ITU_System* system = &ctx.systems[i];
+		if(!itu_mask_contains(component_mask, system->component_mask) || !itu_mask_contains(tag_mask, system->tag_mask))
+			continue;
+
+		for(int j = 0; j < count; ++j)
+			itu_system_entity_add(system, ids[j]);
+	}
+}
+
+// `out_ids` can be NULL
+void itu_entities_instantiate(ITU_Prefab* prefab, ITU_EntityId* out_ids, int count)
+{
+	if(ctx.defer_depth > 0)
+	{
+		ITU_CommandInstantiate* command = (ITU_CommandInstantiate*)itu_command_record(ITU_COMMAND_ENTITIES_INSTANTIATE, ITU_ENTITY_ID_NULL, 0, sizeof(ITU_CommandInstantiate) + sizeof(ITU_EntityId) * count);
+		command->prefab = prefab;
+		command->count = count;
+
+		ITU_EntityId* command_ids = (ITU_EntityId*)(command + 1);
+		SDL_LockMutex(ctx.entities_reserve_mutex);
+		for(int i = 0; i < count; ++i)
+			command_ids[i] = itu_entity_id_next();
+		SDL_UnlockMutex(ctx.entities_reserve_mutex);
+
+		if(out_ids)
+			SDL_memcpy(out_ids, command_ids, sizeof(ITU_EntityId) * count);
+		return;
+	}
+
+	if(!out_ids)
+	{
+		stbds_arrsetlen(ctx.instantiate_ids_scratch, count);
+		out_ids = ctx.instantiate_ids_scratch;
+	}
+
+	for(int i = 0; i < count; ++i)
+		out_ids[i] = itu_entity_id_next();
+	itu_entities_instantiate_at(prefab, out_ids, count);
+}
+
+// creates `count` empty entities at once. `out_ids` can be NULL
+void itu_entity_create_many(ITU_EntityId* out_ids, int count)
+{
+	itu_entities_instantiate(NULL, out_ids, count);
+}
+
+ITU_Prefab* itu_prefab_create()
+{
+	ITU_Prefab* ret = (ITU_Prefab*)SDL_malloc(sizeof(ITU_Prefab));
+	SDL_zerop(ret);
+	return ret;
+}
+
+// NOTE: deferred instantiations still reference the prefab, don't destroy it until they have been played back
+void itu_prefab_destroy(ITU_Prefab* prefab)
+{
+	for(int i = 0; i < COMPONENTS_COUNT_MAX; ++i)
+		SDL_free(prefab->component_defaults[i]);
+	SDL_free(prefab);
+}
+
+// `in_data_copy`: default component init. Can be null
+void itu_prefab_component_add(ITU_Prefab* prefab, ITU_ComponentType component_type, void* in_data_copy)
+{
+	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
+	prefab->component_mask |= itu_mask_bit(component_type);
+
+	SDL_free(prefab->component_defaults[component_type]);
+	prefab->component_defaults[component_type] = NULL;
+	if(in_data_copy)
+	{
+		Uint64 element_size = ctx.components[component_type]->element_size;
+		prefab->component_defaults[component_type] = SDL_malloc(element_size);
+		SDL_memcpy(prefab->component_defaults[component_type], in_data_copy, element_size);
+	}
+}
+
+void itu_prefab_tag_add(ITU_Prefab* prefab, ITU_TagType tag)
+{
+	SDL_assert(tag < TAGS_COUNT_MAX);
+	prefab->tag_mask |= itu_mask_bit(tag);
+}
+
+// spawns `count` copies of the prefab. `out_ids` can be NULL
+void itu_prefab_instantiate(ITU_Prefab* prefab, ITU_EntityId* out_ids, int count)
+{
+	itu_entities_instantiate(prefab, out_ids, count);
+}
+
+void itu_sys_estorage_add_observer(ITU_ObserverEvent event, ITU_ComponentType component_type, ITU_ObserverFunction fn_observer)
+{
+	SDL_assert(event < ITU_OBSERVER_EVENT_MAX);
+	if(event == ITU_OBSERVER_ON_DESTROY)
+		component_type = 0;
+	else
+		SDL_assert(component_type < ctx.components_count);
+
+	ITU_Observer observer;
+	observer.event = event;
+	observer.component_type = component_type;
+	observer.fn = fn_observer;
+	stbds_arrput(ctx.observers, observer);
+
+	ctx.observed_masks[event] |= itu_mask_bit(component_type);
+}
+
+// NOTE: for ITU_OBSERVER_ON_REMOVE, must be called while the entities still have the component (its data is copied)
+void itu_observers_queue(ITU_ObserverEvent event, ITU_ComponentType component_type, ITU_EntityId* ids, int count)
+{
+	if(!itu_mask_test(ctx.observed_masks[event], component_type))
+		return;
+
+	ITU_ObserverQueue* queue = &ctx.observer_queues[event][component_type];
+	SDL_memcpy(stbds_arraddnptr(queue->entity_ids, count), ids, sizeof(ITU_EntityId) * count);
+
+	if(event == ITU_OBSERVER_ON_REMOVE)
+	{
+		ITU_Component* component_pool = ctx.components[component_type];
+		for(int i = 0; i < count; ++i)
+			itu_component_pool_data_get(component_pool, ids[i], stbds_arraddnptr(queue->components_data, component_pool->element_size));
+	}
+
+	ctx.observers_pending = true;
+}
+
+// calls observers for all pending events, until there are none left (observers can cause more of them)
+// NOTE: already called after commands are played back, only needed to get events for changes done outside of systems right away
+void itu_sys_estorage_observers_dispatch()
+{
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+
+	// NOTE: structural changes requested by observers are flushed from inside the loop below, which brings us back here.
+	//       The loop picks up their events anyway
+	if(ctx.observers_dispatching)
+		return;
+
+	ctx.observers_dispatching = true;
+	while(ctx.observers_pending)
+	{
+		ctx.observers_pending = false;
+
+		// NOTE: everything observers do is recorded, so queues can't change while we go through them
+		++ctx.defer_depth;
+		for(int event = 0; event < ITU_OBSERVER_EVENT_MAX; ++event)
+		{
+			int queues_count = event == ITU_OBSERVER_ON_DESTROY ? 1 : ctx.components_count;
+			for(int component_type = 0; component_type < queues_count; ++component_type)
+			{
+				ITU_ObserverQueue* queue = &ctx.observer_queues[event][component_type];
+				int count = stbds_arrlen(queue->entity_ids);
+				if(count == 0)
+					continue;
+
+				void* components_data = event == ITU_OBSERVER_ON_REMOVE ? queue->components_data : NULL;
+				for(int i = 0; i < stbds_arrlen(ctx.observers); ++i)
+				{
+					ITU_Observer* observer = &ctx.observers[i];
+					if(observer->event == event && observer->component_type == component_type)
+						observer->fn(queue->entity_ids, components_data, count);
+				}
+
+				stbds_arrsetlen(queue->entity_ids, 0);
+				stbds_arrsetlen(queue->components_data, 0);
+			}
+		}
+		--ctx.defer_depth;
+
+		itu_sys_estorage_commands_flush();
+	}
+	ctx.observers_dispatching = false;
+}
+
+// from now on, structural changes (create/destroy entities, add/remove components and tags) are recorded instead of applied.
+// Can be nested, commands are played back when the outermost `itu_sys_estorage_defer_end()` is called
+// NOTE: `itu_sys_estorage_systems_update()` already does this around all systems
+void itu_sys_estorage_defer_begin()
+{
+	++ctx.defer_depth;
+}
+
+void itu_sys_estorage_defer_end()
+{
+	SDL_assert(ctx.defer_depth > 0);
+	if(--ctx.defer_depth == 0)
+		itu_sys_estorage_commands_flush();
+}
+
+// plays back all recorded structural changes.
+// Commands recorded by the same thread are applied in order, there is no ordering between different threads
+// (except for creates, that are all applied first so that every other command can reference entities created in the same batch)
+void itu_sys_estorage_commands_flush()
+{
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+
+	int defer_depth = ctx.defer_depth;
+	ctx.defer_depth = 0;
+
+	int threads_count = itu_lib_jobs_get_threads_count();
+	for(int i = 0; i < threads_count; ++i)
+	{
+		Uint8* buffer = ctx.commands[i];
+		int buffer_size = stbds_arrlen(buffer);
+		for(int offset = 0; offset < buffer_size; )
+		{
+			ITU_Command* command = pointer_offset(ITU_Command, buffer, offset);
+			offset += sizeof(ITU_Command) + command->payload_size;
+
+			if(command->type == ITU_COMMAND_ENTITY_CREATE)
+				itu_entity_create_at(command->id);
+			else if(command->type == ITU_COMMAND_ENTITIES_INSTANTIATE)
+			{
+				ITU_CommandInstantiate* instantiate = (ITU_CommandInstantiate*)(command + 1);
+				itu_entities_instantiate_at(instantiate->prefab, (ITU_EntityId*)(instantiate + 1), instantiate->count);
+			}
+		}
+	}
+
+	for(int i = 0; i < threads_count; ++i)
+	{
+		Uint8* buffer = ctx.commands[i];
+		int buffer_size = stbds_arrlen(buffer);
+		for(int offset = 0; offset < buffer_size; )
+		{
+			ITU_Command* command = pointer_offset(ITU_Command, buffer, offset);
+			void* payload = command + 1;
+			offset += sizeof(ITU_Command) + command->payload_size;
+
+			switch(command->type)
+			{
+				case ITU_COMMAND_ENTITY_CREATE:       /* already done */ break;
+				case ITU_COMMAND_ENTITIES_INSTANTIATE: /* already done */ break;
+				case ITU_COMMAND_ENTITY_DESTROY:   itu_entity_destroy(command->id); break;
+				case ITU_COMMAND_COMPONENT_ADD:    itu_entity_component_add(command->id, command->arg, command->payload_size ? payload : NULL); break;
+				case ITU_COMMAND_COMPONENT_REMOVE: itu_entity_component_remove(command->id, command->arg); break;
+				case ITU_COMMAND_TAG_ADD:          itu_entity_tag_add(command->id, command->arg); break;
+				case ITU_COMMAND_TAG_REMOVE:       itu_entity_tag_remove(command->id, command->arg); break;
+				case ITU_COMMAND_RELATION_SET:     itu_entity_relation_set(command->id, command->arg, *(ITU_EntityId*)payload); break;
+				case ITU_COMMAND_RELATION_REMOVE:  itu_entity_relation_remove(command->id, command->arg); break;
+			}
+		}
+		stbds_arrsetlen(ctx.commands[i], 0);
+	}
+
+	ctx.defer_depth = defer_depth;
+
+	itu_sys_estorage_observers_dispatch();
+}
+
+void  itu_entity_set_debug_name(ITU_EntityId id, const char* debug_name)
+{
+	// NOTE: names live in the level arena, so renaming an entity wastes the old name until the next level reset.
+	//       Fine for a debug feature
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+	char* name_storage = itu_lib_arena_strdup(ctx.arena_level, debug_name);
+
+	stbds_hmput(ctx.entities_debug_names, id, name_storage);
+}
+
+bool itu_entity_equals(ITU_EntityId a, ITU_EntityId b)
+{
+	return a.handle == b.handle;
+}
+
+bool itu_entity_is_valid(ITU_EntityId id)
+{
+	// NOTE: ids reserved by deferred creates can point past the end of `entities`.
+	//       Out of range ids are redirected to a sentinel (a conditional move, not a branch), dead slots store an
+	//       invalid index, so a single comparison covers every case
+	Uint32 entities_count = (Uint32)stbds_arrlen(ctx.entities);
+	const ITU_Entity* entity = id.index < entities_count ? &ctx.entities[id.index] : &estorage_entity_sentinel;
+	return entity->id.handle == id.handle;
+}
+
+// replaces the ids of entities that don't exist anymore with ITU_ENTITY_ID_NULL, in a single pass
+void itu_entity_ids_resolve(ITU_EntityId* ids, int count)
+{
+	ITU_EntityId id_null = ITU_ENTITY_ID_NULL;
+	for(int i = 0; i < count; ++i)
+	{
+		Uint64 keep = (Uint64)0 - (Uint64)itu_entity_is_valid(ids[i]);
+		ids[i].handle = (ids[i].handle & keep) | (id_null.handle & ~keep);
+	}
+}
+
+void itu_weakrefs_resolve()
+{
+	itu_entity_ids_resolve(ctx.weak_refs, stbds_arrlen(ctx.weak_refs));
+	ctx.weak_refs_structural_version = ctx.structural_version;
+}
+
+// NOTE: only the main thread can resolve, but while systems run structural changes are deferred,
+//       so the table can't go stale after the resolve done before every phase
+void itu_weakrefs_refresh()
+{
+	if(ctx.weak_refs_structural_version == ctx.structural_version)
+		return;
+
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+	itu_weakrefs_resolve();
+}
+
+// NOTE: references to entities created while deferring are kept, they'll become valid when the creation is played back
+ITU_WeakRef itu_weakref_create(ITU_EntityId target)
+{
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+
+	ITU_WeakRef ret;
+	if(stbds_arrlen(ctx.weak_refs_free) > 0)
+		ret = stbds_arrpop(ctx.weak_refs_free);
+	else
+	{
+		ret = stbds_arrlen(ctx.weak_refs);
+		stbds_arraddnptr(ctx.weak_refs, 1);
+	}
+
+	ctx.weak_refs[ret] = target;
+	return ret;
+}
+
+void itu_weakref_destroy(ITU_WeakRef ref)
+{
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+	SDL_assert(ref < stbds_arrlen(ctx.weak_refs));
+
+	ITU_EntityId id_null = ITU_ENTITY_ID_NULL;
+	ctx.weak_refs[ref] = id_null;
+	stbds_arrput(ctx.weak_refs_free, ref);
+}
+
+void itu_weakref_set(ITU_WeakRef ref, ITU_EntityId target)
+{
+	SDL_assert(ref < stbds_arrlen(ctx.weak_refs));
+	ctx.weak_refs[ref] = target;
+}
+
+// target entity, or ITU_ENTITY_ID_NULL if it doesn't exist anymore
+ITU_EntityId itu_weakref_get(ITU_WeakRef ref)
+{
+	SDL_assert(ref < stbds_arrlen(ctx.weak_refs));
+	itu_weakrefs_refresh();
+	return ctx.weak_refs[ref];
+}
+
+void itu_weakref_get_many(ITU_WeakRef* refs, int count, ITU_EntityId* out_ids)
+{
+	itu_weakrefs_refresh();
+	for(int i = 0; i < count; ++i)
+	{
+		SDL_assert(refs[i] < stbds_arrlen(ctx.weak_refs));
+		out_ids[i] = ctx.weak_refs[refs[i]];
+	}
+}
+
+void itu_entity_id_to_stringid(ITU_EntityId id, char* buffer, int max_len)
+{
+	// NOTE: this is super slow, but we have to do this if we want to leverage imgui for out UI toolkit
+	SDL_snprintf(buffer, max_len, "%d-%d", id.generation, id.index);
+}
+
+// `in_data_copy`: default component init. Can be null
+void itu_entity_component_add(ITU_EntityId id, ITU_ComponentType component_type, void* in_data_copy)
+{
+	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
+	ITU_Mask component_bit = itu_mask_bit(component_type);
+
+	if(ctx.defer_depth > 0)
+	{
+		Uint32 payload_size = in_data_copy ? ctx.components[component_type]->element_size : 0;
+		void* payload = itu_command_record(ITU_COMMAND_COMPONENT_ADD, id, component_type, payload_size);
+		if(in_data_copy)
+			SDL_memcpy(payload, in_data_copy, payload_size);
+		return;
+	}
+
+	if(!itu_entity_is_valid(id))
+	{
+		SDL_Log("WARNING invalid entity\n");
+		return;
+	}
+
+	if(itu_mask_test(ctx.entities[id.index].component_mask, component_type))
+	{
+		SDL_Log("WARNING entity %d alread has component type %d\n", id.index, component_type);
+		return;
+	}
+
+	ctx.entities[id.index].component_mask |= component_bit;
+
+	itu_archetype_entity_remove(id);
+	itu_archetype_entity_add(itu_archetype_get(ctx.entities[id.index].component_mask), id);
+
+	ITU_Component* component = ctx.components[component_type];
+	itu_component_pool_assign(component, id);
+	if(in_data_copy)
+		itu_component_pool_data_set(component, id, in_data_copy);
+
+	itu_systems_entity_refresh(id);
+	itu_observers_queue(ITU_OBSERVER_ON_ADD, component_type, &id, 1);
+}
+
+void itu_entity_component_remove(ITU_EntityId id, ITU_ComponentType component_type)
+{
+	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
+	ITU_Mask component_bit = itu_mask_bit(component_type);
+
+	if(ctx.defer_depth > 0)
+	{
+		itu_command_record(ITU_COMMAND_COMPONENT_REMOVE, id, component_type, 0);
+		return;
+	}
+
+	if(!itu_entity_is_valid(id))
+	{
+		SDL_Log("WARNING invalid entity\n");
+		return;
+	}
+
+	if(!itu_mask_test(ctx.entities[id.index].component_mask, component_type))
+	{
+		SDL_Log("WARNING entity %d does NOT has component type %d\n", id.index, component_type);
+		return;
+	}
+
+	itu_observers_queue(ITU_OBSERVER_ON_REMOVE, component_type, &id, 1);
+
+	ctx.entities[id.index].component_mask &= ~component_bit; // keeps all bits of `id.component_mask` the same except for component_bit, which is set to 0
+
+	itu_archetype_entity_remove(id);
+	itu_archetype_entity_add(itu_archetype_get(ctx.entities[id.index].component_mask), id);
+
+	ITU_Component* component = ctx.components[component_type];
+	itu_component_pool_remove(component, id);
+
+	itu_systems_entity_refresh(id);
+}
+
+void* itu_entity_data_get(ITU_EntityId id, ITU_ComponentType component_type)
+{
+	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
+
+	if(!itu_entity_is_valid(id))
+	{
+		SDL_Log("WARNING invalid entity\n");
+		return NULL;
+	}
+
+	if(!itu_mask_test(ctx.entities[id.index].component_mask, component_type))
+	{
+		//SDL_Log("WARNING entity %d does NOT have component type %d\n", id.index, component_type);
+		return NULL;
+	}
+
+	ITU_Component* component = ctx.components[component_type];
+	
+	// NOTE: the entity has the component, so its page is guaranteed to be there
+	Uint32 loc = component->data_loc_pages[id.index >> COMPONENT_PAGE_SHIFT][id.index & (COMPONENT_PAGE_SIZE - 1)];
+	return pointer_index(component->data, loc, component->element_size);
+}
+
+// same as `itu_entity_data_get()`, but marks the component as changed (see `itu_entity_component_changed()`).
+// Use this when writing to the component
+void* itu_entity_data_get_mut(ITU_EntityId id, ITU_ComponentType component_type)
+{
+	void* ret = itu_entity_data_get(id, component_type);
+	if(ret)
+	{
+		ITU_Component* component = ctx.components[component_type];
+		Uint32 loc = component->data_loc_pages[id.index >> COMPONENT_PAGE_SHIFT][id.index & (COMPONENT_PAGE_SIZE - 1)];
+		component->versions[loc] = ctx.world_version;
+	}
+	return ret;
+}
+
+// true if the component was added, or written through a mutable accessor, after `version`
+bool itu_entity_component_changed_since(ITU_EntityId id, ITU_ComponentType component_type, Uint32 version)
+{
+	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
+
+	if(!itu_entity_is_valid(id) || !itu_mask_test(ctx.entities[id.index].component_mask, component_type))
+		return false;
+
+	ITU_Component* component = ctx.components[component_type];
+	Uint32 loc = component->data_loc_pages[id.index >> COMPONENT_PAGE_SHIFT][id.index & (COMPONENT_PAGE_SIZE - 1)];
+	return component->versions[loc] > version;
+}
+
+// true if the component was added, or written through a mutable accessor, since the last time the current system ran
+// (outside of systems, always true)
+bool itu_entity_component_changed(ITU_EntityId id, ITU_ComponentType component_type)
+{
+	return itu_entity_component_changed_since(id, component_type, estorage_thread_last_run_version);
+}
+
+Uint32 itu_sys_estorage_world_version()
+{
+	return ctx.world_version;
+}
+
+// version changes are compared against inside systems (0 outside of systems)
+Uint32 itu_sys_estorage_last_run_version()
+{
+	return estorage_thread_last_run_version;
+}
+
+// removes the entity from the tag's dense list. Does NOT touch the entity's `tag_mask`
+void itu_tag_entity_remove(ITU_Tag* tag_storage, ITU_EntityId id)
+{
+	// swap-remove, fixing up the location of the entity we moved
+	int loc_curr = tag_storage->entity_locs[id.index];
+	ITU_EntityId id_last = stbds_arrpop(tag_storage->entity_ids);
+	if(loc_curr < stbds_arrlen(tag_storage->entity_ids))
+	{
+		tag_storage->entity_ids[loc_curr] = id_last;
+		tag_storage->entity_locs[id_last.index] = loc_curr;
+	}
+}
+
+void itu_entity_tag_add(ITU_EntityId id, ITU_TagType tag)
+{
+	SDL_assert(tag < TAGS_COUNT_MAX);
+	if(ctx.defer_depth > 0)
+	{
+		itu_command_record(ITU_COMMAND_TAG_ADD, id, tag, 0);
+		return;
+	}
+
+	if(!itu_entity_is_valid(id))
+	{
+		SDL_Log("WARNING invalid entity\n");
+		return;
+	}
+
+	ITU_Entity* entity = &ctx.entities[id.index];
+	if(itu_mask_test(entity->tag_mask, tag))
+		return;
+	entity->tag_mask |= itu_mask_bit(tag);
+
+	// NOTE: `entity_locs` grows lazily, and stale entries are never read since the tag bit tells us if the entity is in the list
+	ITU_Tag* tag_storage = &ctx.tags[tag];
+	if(id.index >= stbds_arrlen(tag_storage->entity_locs))
+		stbds_arrsetlen(tag_storage->entity_locs, id.index + 1);
+	tag_storage->entity_locs[id.index] = stbds_arrlen(tag_storage->entity_ids);
+	stbds_arrput(tag_storage->entity_ids, id);
+
+	itu_systems_entity_refresh(id);
+}
+
+void itu_entity_tag_remove(ITU_EntityId id, ITU_TagType tag)
+{
+	SDL_assert(tag < TAGS_COUNT_MAX);
+	if(ctx.defer_depth > 0)
+	{
+		itu_command_record(ITU_COMMAND_TAG_REMOVE, id, tag, 0);
+		return;
+	}
+
+	if(!itu_entity_is_valid(id))
+	{
+		SDL_Log("WARNING invalid entity\n");
+		return;
+	}
+
+	ITU_Entity* entity = &ctx.entities[id.index];
+	if(!itu_mask_test(entity->tag_mask, tag))
+		return;
+	entity->tag_mask &= ~itu_mask_bit(tag);
+
+	itu_tag_entity_remove(&ctx.tags[tag], id);
+
+	itu_systems_entity_refresh(id);
+}
+
+bool itu_entity_tag_has(ITU_EntityId id, ITU_TagType tag)
+{
+	SDL_assert(tag < TAGS_COUNT_MAX);
+	return itu_entity_is_valid(id) && itu_mask_test(ctx.entities[id.index].tag_mask, tag);
+}
+
+// all the entities that currently have the given tag, in no particular order
+// NOTE: the returned array is only valid until the next time the tag is added to or removed from any entity
+ITU_EntityId* itu_sys_estorage_tag_get_entities(ITU_TagType tag, int* out_count)
+{
+	SDL_assert(tag < TAGS_COUNT_MAX);
+	*out_count = stbds_arrlen(ctx.tags[tag].entity_ids);
+	return ctx.tags[tag].entity_ids;
+}
+
+void itu_sys_estorage_relation_set_debug_name(ITU_RelationType relation, const char* relation_debug_name)
+{
+	SDL_assert(relation < RELATIONS_COUNT_MAX);
+	ctx.relations[relation].debug_name = relation_debug_name;
+}
+
+// ie, for CHILD_OF-like relations
+void itu_sys_estorage_relation_set_destroy_with_target(ITU_RelationType relation, bool destroy_with_target)
+{
+	SDL_assert(relation < RELATIONS_COUNT_MAX);
+	ctx.relations[relation].destroy_with_target = destroy_with_target;
+}
+
+Uint32 itu_relation_index_get(Uint32* index, Uint32 entity_index)
+{
+	return entity_index < stbds_arrlen(index) ? index[entity_index] : COMPONENT_LOC_NONE;
+}
+
+void itu_relation_index_set(Uint32** index, Uint32 entity_index, Uint32 loc)
+{
+	Uint32 count = stbds_arrlen(*index);
+	if(entity_index >= count)
+	{
+		stbds_arrsetlen(*index, entity_index + 1);
+		for(Uint32 i = count; i <= entity_index; ++i)
+			(*index)[i] = COMPONENT_LOC_NONE;
+	}
+	(*index)[entity_index] = loc;
+}
+
+// adds the pair at `loc` to the front of its target's list
+void itu_relation_pair_link(ITU_Relation* relation, Uint32 loc)
+{
+	ITU_RelationPair* pair = &relation->pairs[loc];
+	Uint32 head = itu_relation_index_get(relation->target_heads, pair->target.index);
+	pair->target_prev = COMPONENT_LOC_NONE;
+	pair->target_next = head;
+	if(head != COMPONENT_LOC_NONE)
+		relation->pairs[head].target_prev = loc;
+	itu_relation_index_set(&relation->target_heads, pair->target.index, loc);
+}
+
+void itu_relation_pair_unlink(ITU_Relation* relation, Uint32 loc)
+{
+	ITU_RelationPair* pair = &relation->pairs[loc];
+	if(pair->target_prev != COMPONENT_LOC_NONE)
+		relation->pairs[pair->target_prev].target_next = pair->target_next;
+	else
+		relation->target_heads[pair->target.index] = pair->target_next;
+	if(pair->target_next != COMPONENT_LOC_NONE)
+		relation->pairs[pair->target_next].target_prev = pair->target_prev;
+}
+
+// swap-remove, fixing up the links of the pair we moved
+void itu_relation_pair_remove(ITU_Relation* relation, Uint32 loc)
+{
+	itu_relation_pair_unlink(relation, loc);
+	relation->source_locs[relation->pairs[loc].source.index] = COMPONENT_LOC_NONE;
+
+	Uint32 loc_last = stbds_arrlen(relation->pairs) - 1;
+	if(loc != loc_last)
+	{
+		ITU_RelationPair* pair = &relation->pairs[loc];
+		*pair = relation->pairs[loc_last];
+		relation->source_locs[pair->source.index] = loc;
+		if(pair->target_prev != COMPONENT_LOC_NONE)
+			relation->pairs[pair->target_prev].target_next = loc;
+		else
+			relation->target_heads[pair->target.index] = loc;
+		if(pair->target_next != COMPONENT_LOC_NONE)
+			relation->pairs[pair->target_next].target_prev = loc;
+	}
+	stbds_arrsetlen(relation->pairs, loc_last);
+}
+
+// rebuilds the lookups from the list of pairs (ie, after restoring a snapshot)
+void itu_relation_rebuild(ITU_Relation* relation)
+{
+	stbds_arrsetlen(relation->source_locs, 0);
+	stbds_arrsetlen(relation->target_heads, 0);
+	for(Uint32 i = 0; i < stbds_arrlen(relation->pairs); ++i)
+	{
+		itu_relation_index_set(&relation->source_locs, relation->pairs[i].source.index, i);
+		itu_relation_pair_link(relation, i);
+	}
+}
+
+// replaces the current target, if any
+void itu_entity_relation_set(ITU_EntityId source, ITU_RelationType relation_type, ITU_EntityId target)
+{
+	SDL_assert(relation_type < RELATIONS_COUNT_MAX);
+	if(ctx.defer_depth > 0)
+	{
+		ITU_EntityId* payload = (ITU_EntityId*)itu_command_record(ITU_COMMAND_RELATION_SET, source, relation_type, sizeof(ITU_EntityId));
+		*payload = target;
+		return;
+	}
+
+	if(!itu_entity_is_valid(source) || !itu_entity_is_valid(target))
+	{
+		SDL_Log("WARNING invalid entity\n");
+		return;
+	}
+
+	ITU_Relation* relation = &ctx.relations[relation_type];
+	Uint32 loc = itu_relation_index_get(relation->source_locs, source.index);
+	if(loc != COMPONENT_LOC_NONE)
+	{
+		if(relation->pairs[loc].target.handle == target.handle)
+			return;
+		itu_relation_pair_unlink(relation, loc);
+	}
+	else
+	{
+		loc = stbds_arrlen(relation->pairs);
+		stbds_arraddnptr(relation->pairs, 1);
+		relation->pairs[loc].source = source;
+		itu_relation_index_set(&relation->source_locs, source.index, loc);
+	}
+
+	relation->pairs[loc].target = target;
+	itu_relation_pair_link(relation, loc);
+}
+
+void itu_entity_relation_remove(ITU_EntityId source, ITU_RelationType relation_type)
+{
+	SDL_assert(relation_type < RELATIONS_COUNT_MAX);
+	if(ctx.defer_depth > 0)
+	{
+		itu_command_record(ITU_COMMAND_RELATION_REMOVE, source, relation_type, 0);
+		return;
+	}
+
+	if(!itu_entity_is_valid(source))
+	{
+		SDL_Log("WARNING invalid entity\n");
+		return;
+	}
+
+	ITU_Relation* relation = &ctx.relations[relation_type];
+	Uint32 loc = itu_relation_index_get(relation->source_locs, source.index);
+	if(loc != COMPONENT_LOC_NONE)
+		itu_relation_pair_remove(relation, loc);
+}
+
+// target of the relation, or ITU_ENTITY_ID_NULL if the entity doesn't have it
+ITU_EntityId itu_entity_relation_get(ITU_EntityId source, ITU_RelationType relation_type)
+{
+	SDL_assert(relation_type < RELATIONS_COUNT_MAX);
+
+	ITU_EntityId ret = ITU_ENTITY_ID_NULL;
+	if(!itu_entity_is_valid(source))
+		return ret;
+
+	ITU_Relation* relation = &ctx.relations[relation_type];
+	Uint32 loc = itu_relation_index_get(relation->source_locs, source.index);
+	if(loc != COMPONENT_LOC_NONE)
+		ret = relation->pairs[loc].target;
+	return ret;
+}
+
+// all the entities that have `target` as target of the relation, in no particular order.
+// Writes up to `out_ids_capacity` ids, returns how many there are in total
+int itu_entity_relation_get_sources(ITU_EntityId target, ITU_RelationType relation_type, ITU_EntityId* out_ids, int out_ids_capacity)
+{
+	SDL_assert(relation_type < RELATIONS_COUNT_MAX);
+	if(!itu_entity_is_valid(target))
+		return 0;
+
+	ITU_Relation* relation = &ctx.relations[relation_type];
+	int ret = 0;
+	for(Uint32 loc = itu_relation_index_get(relation->target_heads, target.index); loc != COMPONENT_LOC_NONE; loc = relation->pairs[loc].target_next)
+	{
+		if(ret < out_ids_capacity)
+			out_ids[ret] = relation->pairs[loc].source;
+		++ret;
+	}
+	return ret;
+}
+
+// removes all pairs involving the entity, as source or as target
+void itu_entity_relations_clear(ITU_EntityId id)
+{
+	for(int i = 0; i < RELATIONS_COUNT_MAX; ++i)
+	{
+		ITU_Relation* relation = &ctx.relations[i];
+		if(stbds_arrlen(relation->pairs) == 0)
+			continue;
+
+		Uint32 loc = itu_relation_index_get(relation->source_locs, id.index);
+		if(loc != COMPONENT_LOC_NONE)
+			itu_relation_pair_remove(relation, loc);
+
+		// NOTE: removing (or destroying) the source always unlinks the head, so this moves forward
+		while((loc = itu_relation_index_get(relation->target_heads, id.index)) != COMPONENT_LOC_NONE)
+		{
+			if(relation->destroy_with_target)
+				itu_entity_destroy(relation->pairs[loc].source);
+			else
+				itu_relation_pair_remove(relation, loc);
+		}
+	}
+}
+
+void itu_entity_destroy(ITU_EntityId id)
+{
+	if(ctx.defer_depth > 0)
+	{
+		itu_command_record(ITU_COMMAND_ENTITY_DESTROY, id, 0, 0);
+		return;
+	}
 
 	if(!itu_entity_is_valid(id))
 	{
-		SDL_Log("WARNING invalid entity\n");
-		return;
+		SDL_Log("WARNING invalid entity\n");
+		return;
+	}
+
+	// NOTE: done first, so that sources destroyed together with this entity still find it valid
+	itu_entity_relations_clear(id);
+
+	//ITU_EntityId target_id = ctx.entities[id.index].id;
+	//if(target_id.index == -1)
+	//{
+	//	SDL_Log("WARNING trying to delete entity already deleted\n");
+	//	return;
+	//}
+	//
+	//if(target_id.generation != id.generation)
+	//{
+	//	SDL_Log("WARNING generation mismatch\n");
+	//	return;
+	//}
+
+	ITU_Mask component_mask = ctx.entities[id.index].component_mask;
+
+	++ctx.structural_version;
+
+	// leave the archetype and the systems once, instead of moving through all the intermediate signatures while removing components one by one
+	itu_archetype_entity_remove(id);
+	for(int i = 0; i < ctx.systems_count; ++i)
+		if(itu_system_entity_has(&ctx.systems[i], id))
+			itu_system_entity_remove(&ctx.systems[i], id);
+
+	// free all components
+	for(int i = 0; i < ctx.components_count; ++i)
+	{
+		if(!itu_mask_test(component_mask, i))
+			continue;
+		itu_observers_queue(ITU_OBSERVER_ON_REMOVE, i, &id, 1);
+		itu_component_pool_remove(ctx.components[i], id);
 	}
+	itu_observers_queue(ITU_OBSERVER_ON_DESTROY, 0, &id, 1);
 
-	if(ctx.entities[id.index].component_mask & component_bit)
+	// free all tags (only the ones the entity actually has, stopping at the highest one)
+	ITU_Mask tag_mask = ctx.entities[id.index].tag_mask;
+	for(int w = 0; w < ITU_MASK_WORDS; ++w)
 	{
-		SDL_Log("WARNING entity %d alread has component type %d\n", id.index, component_type);
-		return;
+		Uint64 tag_bits = tag_mask.words[w];
+		for(int i = w * 64; tag_bits; ++i, tag_bits >>= 1)
+			if(tag_bits & 1)
+				itu_tag_entity_remove(&ctx.tags[i], id);
 	}
 
-	ctx.entities[id.index].component_mask |= component_bit;
+	// clear debug name (the string itself stays in the level arena)
+	stbds_hmdel(ctx.entities_debug_names, id);
 
-	ITU_Component* component = ctx.components[component_type];
-	itu_component_pool_assign(component, id);
-	if(in_data_copy)
-		itu_component_pool_data_set(component, id, in_data_copy);
+	ctx.entities[id.index].id.index = -1;
+	ctx.entities[id.index].id.generation++;
+	ctx.entities[id.index].component_mask = 0;
+	ctx.entities[id.index].tag_mask = 0;
+	stbds_arrput(ctx.entities_free, id);
 }
 
-void itu_entity_component_remove(ITU_EntityId id, ITU_ComponentType component_type)
+
+// snapshot layout: header, followed by sections of (Uint64 count, raw array), each padded to 8 bytes
+// - entities, free list
+// - for each component pool: entity ids, data
+// - for each tag: entity ids
+// - for each archetype: signature, entity ids
+// - for each system: entity ids
+// NOTE: lookup tables (component pool pages, `entity_locs`) are not saved, they are rebuilt from the entity ids on restore
+#define ITU_SNAPSHOT_MAGIC 0x53555449 // "ITUS"
+
+struct ITU_SnapshotHeader
 {
-	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
-	Uint64 component_bit = 1ll << component_type;
-	
-	if(!itu_entity_is_valid(id))
+	Uint32 magic;
+	Uint32 entities_index_next;
+	Uint32 components_count;
+	Uint32 tags_count;
+	Uint32 archetypes_count;
+	Uint32 systems_count;
+	Uint32 relations_count;
+	Uint32 padding;
+};
+
+// when `data` is NULL, it only counts the bytes
+struct ITU_SnapshotWriter
+{
+	Uint8* data;
+	Uint64 offset;
+};
+
+struct ITU_SnapshotReader
+{
+	Uint8* data;
+	Uint64 offset;
+	Uint64 size;
+};
+
+// NOTE: empty arrays can be NULL, and memcpy doesn't like NULL even when copying 0 bytes
+void itu_snapshot_copy(void* dst, const void* src, Uint64 size)
+{
+	if(size)
+		SDL_memcpy(dst, src, size);
+}
+
+void itu_snapshot_write(ITU_SnapshotWriter* writer, const void* src, Uint64 size)
+{
+	Uint64 size_aligned = (size + 7) & ~7ull;
+	if(writer->data)
 	{
-		SDL_Log("WARNING invalid entity\n");
-		return;
+		itu_snapshot_copy(writer->data + writer->offset, src, size);
+		SDL_memset(writer->data + writer->offset + size, 0, size_aligned - size);
 	}
+	writer->offset += size_aligned;
+}
+
+void itu_snapshot_write_array(ITU_SnapshotWriter* writer, const void* src, Uint64 count, Uint64 element_size)
+{
+	itu_snapshot_write(writer, &count, sizeof(count));
+	itu_snapshot_write(writer, src, count * element_size);
+}
+
+// returns a pointer to the data inside the snapshot (no copy)
+void* itu_snapshot_read(ITU_SnapshotReader* reader, Uint64 size)
+{
+	SDL_assert(reader->offset + size <= reader->size);
+	void* ret = reader->data + reader->offset;
+	reader->offset += (size + 7) & ~7ull;
+	return ret;
+}
+
+void* itu_snapshot_read_array(ITU_SnapshotReader* reader, Uint64* out_count, Uint64 element_size)
+{
+	*out_count = *(Uint64*)itu_snapshot_read(reader, sizeof(Uint64));
+	return itu_snapshot_read(reader, *out_count * element_size);
+}
+
+void itu_sys_estorage_snapshot_write(ITU_SnapshotWriter* writer)
+{
+	ITU_SnapshotHeader header;
+	SDL_zero(header);
+	header.magic = ITU_SNAPSHOT_MAGIC;
+	header.entities_index_next = ctx.entities_index_next;
+	header.components_count = ctx.components_count;
+	header.tags_count = TAGS_COUNT_MAX;
+	header.archetypes_count = stbds_arrlen(ctx.archetypes);
+	header.systems_count = ctx.systems_count;
+	header.relations_count = RELATIONS_COUNT_MAX;
+	itu_snapshot_write(writer, &header, sizeof(header));
+
+	itu_snapshot_write_array(writer, ctx.entities, stbds_arrlen(ctx.entities), sizeof(ITU_Entity));
+	itu_snapshot_write_array(writer, ctx.entities_free, stbds_arrlen(ctx.entities_free), sizeof(ITU_EntityId));
 
-	if(!(ctx.entities[id.index].component_mask & component_bit))
+	for(int i = 0; i < ctx.components_count; ++i)
 	{
-		SDL_Log("WARNING entity %d does NOT has component type %d\n", id.index, component_type);
-		return;
+		ITU_Component* component_pool = ctx.components[i];
+		itu_snapshot_write_array(writer, component_pool->entity_ids, component_pool->count_alive, sizeof(ITU_EntityId));
+		itu_snapshot_write_array(writer, component_pool->data, component_pool->count_alive, component_pool->element_size);
+	}
+	for(int i = 0; i < TAGS_COUNT_MAX; ++i)
+		itu_snapshot_write_array(writer, ctx.tags[i].entity_ids, stbds_arrlen(ctx.tags[i].entity_ids), sizeof(ITU_EntityId));
+	for(int i = 0; i < stbds_arrlen(ctx.archetypes); ++i)
+	{
+		itu_snapshot_write(writer, &ctx.archetypes[i].component_mask, sizeof(ITU_Mask));
+		itu_snapshot_write_array(writer, ctx.archetypes[i].entity_ids, stbds_arrlen(ctx.archetypes[i].entity_ids), sizeof(ITU_EntityId));
 	}
+	for(int i = 0; i < ctx.systems_count; ++i)
+		itu_snapshot_write_array(writer, ctx.systems[i].entity_ids, stbds_arrlen(ctx.systems[i].entity_ids), sizeof(ITU_EntityId));
+	for(int i = 0; i < RELATIONS_COUNT_MAX; ++i)
+		itu_snapshot_write_array(writer, ctx.relations[i].pairs, stbds_arrlen(ctx.relations[i].pairs), sizeof(ITU_RelationPair));
+}
 
-	ctx.entities[id.index].component_mask &= ~component_bit; // keeps all bits of `id.component_mask` the same except for component_bit, which is set to 0
+// same as `itu_snapshot_read()`, but returns false instead of asserting if the data is not there
+bool itu_snapshot_skip(ITU_SnapshotReader* reader, Uint64 size)
+{
+	Uint64 size_aligned = (size + 7) & ~7ull;
+	if(size_aligned < size || size_aligned > reader->size - reader->offset)
+		return false;
+	reader->offset += size_aligned;
+	return true;
+}
 
-	ITU_Component* component = ctx.components[component_type];
-	itu_component_pool_remove(component, id);
+bool itu_snapshot_skip_array(ITU_SnapshotReader* reader, Uint64 element_size, Uint64* out_count)
+{
+	if(reader->size - reader->offset < sizeof(Uint64))
+		return false;
+
+	Uint64 count = *(Uint64*)(reader->data + reader->offset);
+	reader->offset += sizeof(Uint64);
+	if(out_count)
+		*out_count = count;
+	return (element_size == 0 || count <= reader->size / element_size) && itu_snapshot_skip(reader, count * element_size);
 }
 
-void* itu_entity_data_get(ITU_EntityId id, ITU_ComponentType component_type)
+// checks that the snapshot was taken with the same component pools, tags and systems, and that all sections are in bounds.
+// Cheap (it only looks at the section headers, contents are trusted), enough for snapshots taken in this session.
+// Data coming from outside (ie, world files) needs `itu_snapshot_contents_are_valid()` too
+bool itu_snapshot_is_valid(ITU_Snapshot* snapshot)
 {
-	SDL_assert(component_type < COMPONENTS_COUNT_MAX);
+	ITU_SnapshotReader reader;
+	reader.data = snapshot->data;
+	reader.offset = 0;
+	reader.size = snapshot->size;
+
+	ITU_SnapshotHeader* header = (ITU_SnapshotHeader*)snapshot->data;
+	if(!itu_snapshot_skip(&reader, sizeof(ITU_SnapshotHeader)))
+		return false;
+	if(header->magic != ITU_SNAPSHOT_MAGIC || header->components_count != ctx.components_count || header->tags_count != TAGS_COUNT_MAX || header->systems_count != ctx.systems_count || header->relations_count != RELATIONS_COUNT_MAX)
+		return false;
+
+	Uint64 entities_count;
+	bool ret = itu_snapshot_skip_array(&reader, sizeof(ITU_Entity), &entities_count) && entities_count < COMPONENT_LOC_NONE;
+	ret = ret && itu_snapshot_skip_array(&reader, sizeof(ITU_EntityId), NULL);
+	for(int i = 0; ret && i < ctx.components_count; ++i)
+		ret = itu_snapshot_skip_array(&reader, sizeof(ITU_EntityId), NULL) && itu_snapshot_skip_array(&reader, ctx.components[i]->element_size, NULL);
+	for(int i = 0; ret && i < TAGS_COUNT_MAX; ++i)
+		ret = itu_snapshot_skip_array(&reader, sizeof(ITU_EntityId), NULL);
+	for(int i = 0; ret && i < header->archetypes_count; ++i)
+		ret = itu_snapshot_skip(&reader, sizeof(ITU_Mask)) && itu_snapshot_skip_array(&reader, sizeof(ITU_EntityId), NULL);
+	for(int i = 0; ret && i < ctx.systems_count; ++i)
+		ret = itu_snapshot_skip_array(&reader, sizeof(ITU_EntityId), NULL);
+	for(int i = 0; ret && i < RELATIONS_COUNT_MAX; ++i)
+		ret = itu_snapshot_skip_array(&reader, sizeof(ITU_RelationPair), NULL);
 
-	if(!itu_entity_is_valid(id))
+	return ret;
+}
+
+bool itu_snapshot_ids_are_in_range(ITU_EntityId* ids, Uint64 count, Uint64 entities_count)
+{
+	for(Uint64 i = 0; i < count; ++i)
+		if(ids[i].index >= entities_count)
+			return false;
+	return true;
+}
+
+// checks everything restoring uses as an index: entity ids in every section must be in the range of the saved entities,
+// and entities must point to archetypes (and locations inside them) that exist.
+// Linear in the size of the snapshot. Assumes `itu_snapshot_is_valid()` already passed
+// NOTE: it doesn't check that sections agree with each other (ie, that an entity is in the pool of every component in its
+//       signature), a file edited by hand can still give a broken world. It won't write outside of the storage while restoring though
+bool itu_snapshot_contents_are_valid(ITU_Snapshot* snapshot)
+{
+	ITU_SnapshotReader reader;
+	reader.data = snapshot->data;
+	reader.offset = 0;
+	reader.size = snapshot->size;
+
+	ITU_SnapshotHeader* header = (ITU_SnapshotHeader*)itu_snapshot_read(&reader, sizeof(ITU_SnapshotHeader));
+
+	Uint64 count;
+	Uint64 entities_count;
+	ITU_Entity* entities = (ITU_Entity*)itu_snapshot_read_array(&reader, &entities_count, sizeof(ITU_Entity));
+	bool ret = header->entities_index_next <= entities_count;
+
+	ITU_EntityId* ids = (ITU_EntityId*)itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+	ret = ret && itu_snapshot_ids_are_in_range(ids, count, entities_count);
+	for(int i = 0; i < ctx.components_count; ++i)
 	{
-		SDL_Log("WARNING invalid entity\n");
-		return NULL;
+		Uint64 data_count;
+		ids = (ITU_EntityId*)itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+		itu_snapshot_read_array(&reader, &data_count, ctx.components[i]->element_size);
+		ret = ret && count == data_count && itu_snapshot_ids_are_in_range(ids, count, entities_count);
+	}
+	for(int i = 0; i < TAGS_COUNT_MAX; ++i)
+	{
+		ids = (ITU_EntityId*)itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+		ret = ret && itu_snapshot_ids_are_in_range(ids, count, entities_count);
 	}
 
-	Uint64 component_bit = 1ll << component_type;
-	if(!(ctx.entities[id.index].component_mask & component_bit))
+	stbds_arr(Uint64) archetypes_sizes = NULL;
+	stbds_arrsetlen(archetypes_sizes, header->archetypes_count);
+	for(int i = 0; i < header->archetypes_count; ++i)
 	{
-		//SDL_Log("WARNING entity %d does NOT have component type %d\n", id.index, component_type);
-		return NULL;
+		itu_snapshot_read(&reader, sizeof(ITU_Mask));
+		ids = (ITU_EntityId*)itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+		ret = ret && itu_snapshot_ids_are_in_range(ids, count, entities_count);
+		archetypes_sizes[i] = count;
+	}
+	for(int i = 0; i < ctx.systems_count; ++i)
+	{
+		ids = (ITU_EntityId*)itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+		ret = ret && itu_snapshot_ids_are_in_range(ids, count, entities_count);
+	}
+	for(int i = 0; i < RELATIONS_COUNT_MAX; ++i)
+	{
+		ITU_RelationPair* pairs = (ITU_RelationPair*)itu_snapshot_read_array(&reader, &count, sizeof(ITU_RelationPair));
+		for(Uint64 j = 0; ret && j < count; ++j)
+			ret = pairs[j].source.index < entities_count && pairs[j].target.index < entities_count;
 	}
 
-	ITU_Component* component = ctx.components[component_type];
-	
-	Uint64 loc = component->data_loc[id.index];
-	return pointer_index(component->data, loc, component->element_size);
+	// NOTE: dead entities keep an invalid index (and no archetype)
+	for(Uint64 i = 0; ret && i < entities_count; ++i)
+	{
+		ITU_Entity* entity = &entities[i];
+		ret = entity->id.index == i || entity->id.index == (Uint32)-1;
+		if(ret && entity->archetype >= 0)
+			ret = entity->archetype < header->archetypes_count && entity->archetype_loc >= 0 && entity->archetype_loc < archetypes_sizes[entity->archetype];
+	}
+	stbds_arrfree(archetypes_sizes);
+
+	return ret;
 }
 
-void itu_entity_tag_add(ITU_EntityId id, ITU_TagType tag)
+// `capacity`: size of the buffer. Use `itu_sys_estorage_snapshot_size()` to get an idea of how much is needed
+ITU_Snapshot* itu_snapshot_create(Uint64 capacity)
 {
-	SDL_assert(tag < TAGS_COUNT_MAX);
-	ITU_ComponentTagStorage foo = { id };
-	stbds_hmputs(ctx.tags[tag], foo);
+	ITU_Snapshot* ret = (ITU_Snapshot*)SDL_malloc(sizeof(ITU_Snapshot));
+	SDL_zerop(ret);
+	ret->data = (Uint8*)SDL_malloc(capacity);
+	ret->capacity = capacity;
+
+	return ret;
 }
 
-void itu_entity_tag_remove(ITU_EntityId id, ITU_TagType tag)
+void itu_snapshot_destroy(ITU_Snapshot* snapshot)
 {
-	SDL_assert(tag < TAGS_COUNT_MAX);
-	stbds_hmdel(ctx.tags[tag], id);
+	SDL_free(snapshot->data);
+	SDL_free(snapshot);
 }
 
-bool itu_entity_tag_has(ITU_EntityId id, ITU_TagType tag)
+// bytes needed to snapshot the current state
+Uint64 itu_sys_estorage_snapshot_size()
 {
-	SDL_assert(tag < TAGS_COUNT_MAX);
-	return stbds_hmgeti(ctx.tags[tag], id) != -1;
+	ITU_SnapshotWriter writer;
+	SDL_zero(writer);
+	itu_sys_estorage_snapshot_write(&writer);
+	return writer.offset;
 }
 
-void itu_entity_destroy(ITU_EntityId id)
+// copies the whole entity storage in the snapshot buffer. Returns false (leaving the snapshot untouched) if it doesn't fit
+// NOTE: only the entity storage is saved. Anything that lives outside of it (ie, box2d bodies referenced by `PhysicsData`,
+//       textures referenced by `Sprite`) is NOT, restoring only checks it through load fixups (see `itu_sys_estorage_restore()`)
+bool itu_sys_estorage_snapshot(ITU_Snapshot* snapshot)
 {
-	if(!itu_entity_is_valid(id))
+	SDL_assert(ctx.defer_depth == 0);
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+
+	Uint64 size = itu_sys_estorage_snapshot_size();
+	if(size > snapshot->capacity)
 	{
-		SDL_Log("WARNING invalid entity\n");
-		return;
+		SDL_Log("WARNING snapshot doesn't fit (needs %llu bytes, capacity is %llu)\n", (unsigned long long)size, (unsigned long long)snapshot->capacity);
+		return false;
 	}
 
-	//ITU_EntityId target_id = ctx.entities[id.index].id;
-	//if(target_id.index == -1)
-	//{
-	//	SDL_Log("WARNING trying to delete entity already deleted\n");
-	//	return;
-	//}
-	//
-	//if(target_id.generation != id.generation)
-	//{
-	//	SDL_Log("WARNING generation mismatch\n");
-	//	return;
-	//}
+	ITU_SnapshotWriter writer;
+	writer.data = snapshot->data;
+	writer.offset = 0;
+	itu_sys_estorage_snapshot_write(&writer);
+	snapshot->size = writer.offset;
 
-	Uint64 component_mask = ctx.entities[id.index].component_mask;
+	return true;
+}
 
-	// free all components
-	// TODO faster way to do this?
+// reports components and entities that are alive now but not in the snapshot as removed/destroyed, so that observers can free
+// what they own before the world jumps back. Pending events are delivered first (they are about the world we are leaving)
+// NOTE: a component survives the restore if the same entity (same generation) has it in the snapshot too, nothing is reported for it.
+//       Whatever it owns is assumed to still be the same (see `itu_sys_estorage_fixups_run()`)
+void itu_snapshot_report_leaving(ITU_Snapshot* snapshot)
+{
+	ITU_SnapshotReader reader;
+	reader.data = snapshot->data;
+	reader.offset = 0;
+	reader.size = snapshot->size;
+
+	itu_snapshot_read(&reader, sizeof(ITU_SnapshotHeader));
+	Uint64 snapshot_entities_count;
+	ITU_Entity* snapshot_entities = (ITU_Entity*)itu_snapshot_read_array(&reader, &snapshot_entities_count, sizeof(ITU_Entity));
+
+	stbds_arr(ITU_EntityId) leaving = NULL;
+	for(int i = 0; i < ctx.components_count; ++i)
+	{
+		if(!itu_mask_test(ctx.observed_masks[ITU_OBSERVER_ON_REMOVE], i))
+			continue;
+
+		ITU_Component* component_pool = ctx.components[i];
+		stbds_arrsetlen(leaving, 0);
+		for(int j = 0; j < component_pool->count_alive; ++j)
+		{
+			ITU_EntityId id = component_pool->entity_ids[j];
+			bool kept = id.index < snapshot_entities_count && snapshot_entities[id.index].id.handle == id.handle && itu_mask_test(snapshot_entities[id.index].component_mask, i);
+			if(!kept)
+				stbds_arrput(leaving, id);
+		}
+		itu_observers_queue(ITU_OBSERVER_ON_REMOVE, i, leaving, stbds_arrlen(leaving));
+	}
+
+	for(int i = 0; i < stbds_arrlen(ctx.entities); ++i)
+	{
+		ITU_EntityId id = ctx.entities[i].id;
+		bool kept = id.index < snapshot_entities_count && snapshot_entities[id.index].id.handle == id.handle;
+		if(itu_entity_is_valid(id) && !kept)
+			itu_observers_queue(ITU_OBSERVER_ON_DESTROY, 0, &ctx.entities[i].id, 1);
+	}
+	stbds_arrfree(leaving);
+
+	// NOTE: structural changes requested by observers are applied to the world we are leaving, and wiped right after
+	itu_sys_estorage_observers_dispatch();
+	SDL_assert(!ctx.observers_pending);
+}
+
+// runs `fn_load_fixup` on every element of the pools that have one, removing the components it rejects (reported as usual)
+void itu_sys_estorage_fixups_run()
+{
+	stbds_arr(ITU_EntityId) rejected = NULL;
 	for(int i = 0; i < ctx.components_count; ++i)
 	{
-		Uint64 component_bit = 1ll << i;
-		if(!(component_mask & component_bit))
+		ITU_Component* component_pool = ctx.components[i];
+		if(!component_pool->fn_load_fixup)
 			continue;
-		itu_entity_component_remove(id, i);
+
+		stbds_arrsetlen(rejected, 0);
+		for(int j = 0; j < component_pool->count_alive; ++j)
+			if(!component_pool->fn_load_fixup(component_pool->entity_ids[j], pointer_index(component_pool->data, j, component_pool->element_size)))
+				stbds_arrput(rejected, component_pool->entity_ids[j]);
+
+		// NOTE: removing moves elements around, so it's done after the whole pool has been visited
+		for(int j = 0; j < stbds_arrlen(rejected); ++j)
+			itu_entity_component_remove(rejected[j], component_pool->type);
+		if(stbds_arrlen(rejected) > 0)
+			SDL_Log("WARNING %d %s components could not be restored, removed\n", (int)stbds_arrlen(rejected), component_pool->name);
+	}
+	stbds_arrfree(rejected);
+
+	itu_sys_estorage_observers_dispatch();
+}
+
+// brings the entity storage back to the state saved in the snapshot.
+// Component pools, tags and systems must be the same as when the snapshot was taken
+// - components and entities that are not in the snapshot are reported as removed/destroyed (and dispatched, together with
+//   any pending event) before restoring
+// - nothing is reported for restored ones, load fixups (see `add_component_load_fixup()`) are run on them right after.
+//   Components rejected by their fixup are removed
+// NOTE: anything living outside of the entity storage (box2d bodies, tilemap tiles, textures) is referenced, not saved.
+//       Components owning such resources MUST have a load fixup checking them (the standard ones do, see `itu_sys_estorage_init()`):
+//       without it, restoring after the owner was removed (ie, snapshot, destroy an asteroid, restore) brings back dangling
+//       pointers, freed a second time when the component goes away. Resources replaced in the meantime on an entity
+//       that survives the restore are leaked
+// NOTE: all cached queries are invalidated. Debug names are not part of the snapshot
+void itu_sys_estorage_restore(ITU_Snapshot* snapshot)
+{
+	SDL_assert(ctx.defer_depth == 0);
+	SDL_assert(!itu_lib_jobs_is_inside_job());
+	SDL_assert(snapshot->size > 0);
+
+	ITU_SnapshotReader reader;
+	reader.data = snapshot->data;
+	reader.offset = 0;
+	reader.size = snapshot->size;
+
+	SDL_assert(itu_snapshot_is_valid(snapshot));
+	itu_snapshot_report_leaving(snapshot);
+
+	ITU_SnapshotHeader* header = (ITU_SnapshotHeader*)itu_snapshot_read(&reader, sizeof(ITU_SnapshotHeader));
+
+	++ctx.structural_version;
+	++ctx.world_version;
+	ctx.entities_index_next = header->entities_index_next;
+
+	Uint64 count;
+	void* src;
+
+	src = itu_snapshot_read_array(&reader, &count, sizeof(ITU_Entity));
+	stbds_arrsetlen(ctx.entities, count);
+	itu_snapshot_copy(ctx.entities, src, count * sizeof(ITU_Entity));
+	int entities_count = count;
+
+	src = itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+	stbds_arrsetlen(ctx.entities_free, count);
+	itu_snapshot_copy(ctx.entities_free, src, count * sizeof(ITU_EntityId));
+
+	for(int i = 0; i < ctx.components_count; ++i)
+	{
+		ITU_Component* component_pool = ctx.components[i];
+
+		// NOTE: pages are kept (just marked empty), they will most likely be needed again
+		for(int page = 0; page < stbds_arrlen(component_pool->data_loc_pages); ++page)
+			if(component_pool->data_loc_pages[page])
+				SDL_memset(component_pool->data_loc_pages[page], 0xff, sizeof(Uint32) * COMPONENT_PAGE_SIZE);
+
+		ITU_EntityId* entity_ids = (ITU_EntityId*)itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+		itu_component_pool_reserve(component_pool, count);
+		itu_snapshot_copy(component_pool->entity_ids, entity_ids, count * sizeof(ITU_EntityId));
+		for(int j = 0; j < count; ++j)
+			itu_component_pool_loc_set(component_pool, entity_ids[j].index, j);
+
+		src = itu_snapshot_read_array(&reader, &count, component_pool->element_size);
+		itu_snapshot_copy(component_pool->data, src, count * component_pool->element_size);
+
+		// NOTE: write versions are not saved, everything restored counts as just written
+		for(int j = 0; j < count; ++j)
+			component_pool->versions[j] = ctx.world_version;
+
+		component_pool->count_alive = count;
+		component_pool->order_version++;
+		component_pool->sort_cursor = 0;
+		component_pool->sort_cursor_dst = 0;
+		component_pool->sort_gap = 0;
 	}
 
-	// free all tags
-	// TODO faster way to do this?
 	for(int i = 0; i < TAGS_COUNT_MAX; ++i)
-		itu_entity_tag_remove(id, i);
+	{
+		ITU_Tag* tag_storage = &ctx.tags[i];
+		src = itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+		stbds_arrsetlen(tag_storage->entity_ids, count);
+		itu_snapshot_copy(tag_storage->entity_ids, src, count * sizeof(ITU_EntityId));
+
+		// NOTE: stale entries in `entity_locs` are never read, we only need to fix the ones of tagged entities
+		if(stbds_arrlen(tag_storage->entity_locs) < entities_count)
+			stbds_arrsetlen(tag_storage->entity_locs, entities_count);
+		for(int j = 0; j < count; ++j)
+			tag_storage->entity_locs[tag_storage->entity_ids[j].index] = j;
+	}
 
-	// clear debug name
-	int pos_name_storage = stbds_hmgeti(ctx.entities_debug_names, id);
-	if(pos_name_storage != -1)
+	// NOTE: archetypes are matched by signature, since their indices can be different from the ones at snapshot time
+	//       (ie, when loading a world file in a new session). Archetypes are never destroyed, the ones that are not in
+	//       the snapshot are simply left empty
+	for(int i = 0; i < stbds_arrlen(ctx.archetypes); ++i)
+		stbds_arrsetlen(ctx.archetypes[i].entity_ids, 0);
+
+	stbds_arrsetlen(ctx.restore_archetypes_remap, header->archetypes_count);
+	for(int i = 0; i < header->archetypes_count; ++i)
 	{
-		// NOTE: as mentioned when allocating this, doing alloc/dealloc of every single name in isolation is not good for peformance
-		//       we'll give ourself a pass for this since this is a debug feature, but it's worth to keep in mind
-		SDL_free(ctx.entities_debug_names[pos_name_storage].value);
-		stbds_hmdel(ctx.entities_debug_names, id);
+		ITU_Mask* component_mask = (ITU_Mask*)itu_snapshot_read(&reader, sizeof(ITU_Mask));
+		int archetype_idx = itu_archetype_get(*component_mask);
+		ctx.restore_archetypes_remap[i] = archetype_idx;
+
+		ITU_Archetype* archetype = &ctx.archetypes[archetype_idx];
+		src = itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+		stbds_arrsetlen(archetype->entity_ids, count);
+		itu_snapshot_copy(archetype->entity_ids, src, count * sizeof(ITU_EntityId));
 	}
 
-	ctx.entities[id.index].id.index = -1;
-	ctx.entities[id.index].id.generation++;
-	ctx.entities[id.index].component_mask = 0;
-	stbds_arrput(ctx.entities_free, id);
+	for(int i = 0; i < entities_count; ++i)
+		if(ctx.entities[i].archetype >= 0)
+			ctx.entities[i].archetype = ctx.restore_archetypes_remap[ctx.entities[i].archetype];
+
+	for(int i = 0; i < ctx.systems_count; ++i)
+	{
+		ITU_System* system = &ctx.systems[i];
+		src = itu_snapshot_read_array(&reader, &count, sizeof(ITU_EntityId));
+		stbds_arrsetlen(system->entity_ids, count);
+		itu_snapshot_copy(system->entity_ids, src, count * sizeof(ITU_EntityId));
+
+		stbds_arrsetlen(system->entity_locs, entities_count);
+		for(int j = 0; j < entities_count; ++j)
+			system->entity_locs[j] = -1;
+		for(int j = 0; j < count; ++j)
+			system->entity_locs[system->entity_ids[j].index] = j;
+		system->order_version++;
+	}
+
+	// NOTE: only the pairs are meaningful, the reverse index is rebuilt (it points inside the pairs array)
+	for(int i = 0; i < RELATIONS_COUNT_MAX; ++i)
+	{
+		ITU_Relation* relation = &ctx.relations[i];
+		src = itu_snapshot_read_array(&reader, &count, sizeof(ITU_RelationPair));
+		stbds_arrsetlen(relation->pairs, count);
+		itu_snapshot_copy(relation->pairs, src, count * sizeof(ITU_RelationPair));
+		itu_relation_rebuild(relation);
+	}
+
+	itu_sys_estorage_fixups_run();
+}
+
+// world files: a small header followed by a snapshot (see `itu_sys_estorage_snapshot()`), so component pools map 1:1 to file sections
+// and loading is a single read plus one memcpy per section, instead of building the world one entity at a time.
+// File layout:
+// - ITU_WorldFileHeader
+// - Uint64 layout hash for each component pool
+// - ITU_WorldFileTexture for each texture created with `texture_create()`
+// - snapshot
+#define ITU_WORLD_FILE_MAGIC    0x57555449 // "ITUW"
+#define ITU_WORLD_FILE_VERSION  3          // bump this every time the snapshot layout changes
+#define ITU_WORLD_FILE_PATH_MAX 248
+
+struct ITU_WorldFileHeader
+{
+	Uint32 magic;
+	Uint32 version;
+	Uint64 layout_hash; // hash of all the component layouts, plus the engine types that end up in the snapshot
+	Uint32 components_count;
+	Uint32 textures_count;
+	Uint64 snapshot_size;
+	Uint64 session_id;  // `ctx.session_id` of the run that saved the file
+};
+
+// textures are saved by path, so that pointers saved in components can be mapped to the ones of the session loading the file
+struct ITU_WorldFileTexture
+{
+	Uint64 texture;
+	char path[ITU_WORLD_FILE_PATH_MAX];
+};
+
+Uint64 itu_sys_estorage_layout_hash()
+{
+	Uint32 engine_layout[] = { (Uint32)sizeof(ITU_Entity), (Uint32)sizeof(ITU_EntityId), (Uint32)sizeof(ITU_Mask), TAGS_COUNT_MAX, (Uint32)ctx.components_count, (Uint32)ctx.systems_count, RELATIONS_COUNT_MAX, (Uint32)sizeof(ITU_RelationPair) };
+	Uint64 ret = itu_hash_fnv1a(engine_layout, sizeof(engine_layout), ITU_HASH_FNV1A_SEED);
+	for(int i = 0; i < ctx.components_count; ++i)
+		ret = itu_hash_fnv1a(&ctx.components[i]->layout_hash, sizeof(Uint64), ret);
+	return ret;
+}
+
+bool itu_sys_estorage_save(const char* path)
+{
+	ITU_Snapshot* snapshot = itu_snapshot_create(itu_sys_estorage_snapshot_size());
+	itu_sys_estorage_snapshot(snapshot);
+
+	ITU_WorldFileHeader header;
+	SDL_zero(header);
+	header.magic = ITU_WORLD_FILE_MAGIC;
+	header.version = ITU_WORLD_FILE_VERSION;
+	header.layout_hash = itu_sys_estorage_layout_hash();
+	header.components_count = ctx.components_count;
+	header.snapshot_size = snapshot->size;
+	header.session_id = ctx.session_id;
+
+	int textures_count;
+	TextureInfo* textures = texture_get_all(&textures_count);
+	stbds_arr(ITU_WorldFileTexture) file_textures = NULL;
+	for(int i = 0; i < textures_count; ++i)
+	{
+		if(SDL_strlen(textures[i].path) >= ITU_WORLD_FILE_PATH_MAX)
+		{
+			SDL_Log("WARNING texture path %s is too long, it won't be found when loading\n", textures[i].path);
+			continue;
+		}
+
+		ITU_WorldFileTexture* file_texture = stbds_arraddnptr(file_textures, 1);
+		SDL_zerop(file_texture);
+		file_texture->texture = (Uint64)(uintptr_t)textures[i].texture;
+		SDL_strlcpy(file_texture->path, textures[i].path, ITU_WORLD_FILE_PATH_MAX);
+	}
+	header.textures_count = stbds_arrlen(file_textures);
+
+	bool ret = false;
+	SDL_IOStream* file = SDL_IOFromFile(path, "wb");
+	if(file)
+	{
+		ret = SDL_WriteIO(file, &header, sizeof(header)) == sizeof(header);
+		for(int i = 0; ret && i < ctx.components_count; ++i)
+			ret = SDL_WriteIO(file, &ctx.components[i]->layout_hash, sizeof(Uint64)) == sizeof(Uint64);
+		Uint64 textures_size = sizeof(ITU_WorldFileTexture) * header.textures_count;
+		ret = ret && SDL_WriteIO(file, file_textures, textures_size) == textures_size;
+		ret = ret && SDL_WriteIO(file, snapshot->data, snapshot->size) == snapshot->size;
+		ret = SDL_CloseIO(file) && ret;
+	}
+	if(!ret)
+		SDL_Log("ERROR unable to save world to %s: %s\n", path, SDL_GetError());
+
+	stbds_arrfree(file_textures);
+	itu_snapshot_destroy(snapshot);
+	return ret;
+}
+
+// replaces all entities with the ones in the world file. Component pools, tags and systems must be set up the same way as when saving.
+// Returns false (leaving the current world untouched) if the file is missing, corrupted, or was saved with a different layout
+// NOTE: components holding pointers (or handles to anything that lives outside of the entity storage) need a load fixup
+//       to make them valid again (see `add_component_load_fixup()`). Textures are remapped with `itu_sys_estorage_load_texture()`,
+//       anything else (bodies, tiles) can only be taken back when loading a file saved in this same session
+bool itu_sys_estorage_load(const char* path)
+{
+	SDL_assert(ctx.defer_depth == 0);
+
+	size_t file_size;
+	Uint8* file = (Uint8*)SDL_LoadFile(path, &file_size);
+	if(!file)
+	{
+		SDL_Log("ERROR unable to load world from %s: %s\n", path, SDL_GetError());
+		return false;
+	}
+
+	bool ret = false;
+	ITU_WorldFileHeader* header = (ITU_WorldFileHeader*)file;
+	Uint64 header_size = sizeof(ITU_WorldFileHeader) + sizeof(Uint64) * ctx.components_count;
+	if(file_size < sizeof(ITU_WorldFileHeader) || header->magic != ITU_WORLD_FILE_MAGIC)
+		SDL_Log("ERROR %s is not a world file\n", path);
+	else if(header->version != ITU_WORLD_FILE_VERSION)
+		SDL_Log("ERROR %s has version %u, expected %u\n", path, header->version, ITU_WORLD_FILE_VERSION);
+	else if(header->components_count != ctx.components_count || file_size < header_size)
+		SDL_Log("ERROR %s has %u components, expected %d\n", path, header->components_count, ctx.components_count);
+	else if(header->layout_hash != itu_sys_estorage_layout_hash())
+	{
+		Uint64* layout_hashes = (Uint64*)(file + sizeof(ITU_WorldFileHeader));
+		for(int i = 0; i < ctx.components_count; ++i)
+			if(layout_hashes[i] != ctx.components[i]->layout_hash)
+				SDL_Log("ERROR %s: component %s changed since the file was saved\n", path, ctx.components[i]->name);
+		SDL_Log("ERROR %s was saved with a different layout\n", path);
+	}
+	else if((file_size - header_size) / sizeof(ITU_WorldFileTexture) < header->textures_count ||
+	        file_size - header_size - sizeof(ITU_WorldFileTexture) * header->textures_count < header->snapshot_size)
+		SDL_Log("ERROR %s is truncated\n", path);
+	else
+	{
+		ITU_WorldFileTexture* textures = (ITU_WorldFileTexture*)(file + header_size);
+
+		// NOTE: the snapshot is used in place, straight from the file buffer
+		ITU_Snapshot snapshot;
+		snapshot.data = file + header_size + sizeof(ITU_WorldFileTexture) * header->textures_count;
+		snapshot.size = header->snapshot_size;
+		snapshot.capacity = header->snapshot_size;
+
+		if(!itu_snapshot_is_valid(&snapshot) || !itu_snapshot_contents_are_valid(&snapshot))
+			SDL_Log("ERROR %s is corrupted\n", path);
+		else
+		{
+			// NOTE: bodies and tiles saved by a different session don't exist anymore, and their handles could match whatever lives
+			//       in the current world. Clearing it first makes sure fixups drop them, instead of sharing them with new components
+			ctx.loading_same_session = header->session_id == ctx.session_id;
+			if(!ctx.loading_same_session)
+				itu_sys_estorage_clear_all_entities();
+
+			for(Uint32 i = 0; i < header->textures_count; ++i)
+			{
+				textures[i].path[ITU_WORLD_FILE_PATH_MAX - 1] = 0;
+				SDL_Texture* texture = texture_find(textures[i].path);
+				if(!texture)
+					SDL_Log("WARNING %s: texture %s was not created in this session\n", path, textures[i].path);
+				stbds_hmput(ctx.load_textures_remap, textures[i].texture, texture);
+			}
+
+			ctx.loading = true;
+			itu_sys_estorage_restore(&snapshot);
+			ctx.loading = false;
+			stbds_hmfree(ctx.load_textures_remap);
+			ret = true;
+		}
+	}
+	SDL_free(file);
+
+	return ret;
+}
+
+// while loading a world file (from inside load fixups), maps a texture saved in the file to the one created from the same path
+// in this session (NULL if there is none). Returns `texture` unchanged outside of `itu_sys_estorage_load()`
+SDL_Texture* itu_sys_estorage_load_texture(SDL_Texture* texture)
+{
+	if(!ctx.loading || !texture)
+		return texture;
+
+	int idx = stbds_hmgeti(ctx.load_textures_remap, (Uint64)(uintptr_t)texture);
+	if(idx >= 0)
+		return ctx.load_textures_remap[idx].value;
+
+	// NOTE: not created with `texture_create()`, the pointer is only good if the file was saved by this session
+	return ctx.loading_same_session ? texture : NULL;
 }
 
+// writes `snapshot` as a delta against `base`: the two are XORed word by word, and runs of zero words (everything that didn't change)
+// are skipped entirely. Consecutive snapshots are mostly identical, so deltas are usually a small fraction of the full size.
+// Returns the size of the delta, or 0 if it doesn't fit in `out_delta_capacity`.
+// Format: Uint64 snapshot size, then tokens of (Uint32 unchanged words count, Uint32 changed words count, changed words XORed with base)
+Uint64 itu_snapshot_delta_encode(ITU_Snapshot* base, ITU_Snapshot* snapshot, Uint8* out_delta, Uint64 out_delta_capacity)
+{
+	// NOTE: snapshots are always made of 8-byte words (see `itu_snapshot_write()`)
+	Uint64* words      = (Uint64*)snapshot->data;
+	Uint64* words_base = (Uint64*)base->data;
+	Uint64 words_count      = snapshot->size / 8;
+	Uint64 words_base_count = base->size / 8;
+
+	Uint64 offset = 0;
+	if(out_delta_capacity < sizeof(Uint64))
+		return 0;
+	SDL_memcpy(out_delta, &snapshot->size, sizeof(Uint64));
+	offset += sizeof(Uint64);
+
+	Uint64 i = 0;
+	while(i < words_count)
+	{
+		Uint32 unchanged_count = 0;
+		while(i < words_count && (words[i] ^ (i < words_base_count ? words_base[i] : 0)) == 0 && unchanged_count < SDL_MAX_UINT32)
+		{
+			++unchanged_count;
+			++i;
+		}
+
+		Uint64 changed_first = i;
+		Uint32 changed_count = 0;
+		while(i < words_count && (words[i] ^ (i < words_base_count ? words_base[i] : 0)) != 0 && changed_count < SDL_MAX_UINT32)
+		{
+			++changed_count;
+			++i;
+		}
+
+		if(offset + sizeof(Uint32) * 2 + changed_count * sizeof(Uint64) > out_delta_capacity)
+			return 0;
+
+		SDL_memcpy(out_delta + offset, &unchanged_count, sizeof(Uint32));
+		SDL_memcpy(out_delta + offset + sizeof(Uint32), &changed_count, sizeof(Uint32));
+		offset += sizeof(Uint32) * 2;
+		for(Uint64 j = changed_first; j < changed_first + changed_count; ++j)
+		{
+			Uint64 word = words[j] ^ (j < words_base_count ? words_base[j] : 0);
+			SDL_memcpy(out_delta + offset, &word, sizeof(Uint64));
+			offset += sizeof(Uint64);
+		}
+	}
+
+	return offset;
+}
+
+// rebuilds a snapshot from `base` and a delta made by `itu_snapshot_delta_encode()` against the same base.
+// Returns false if the result doesn't fit in `out_snapshot`, or if the delta is malformed or doesn't give a valid snapshot
+// (deltas can come from the network, so nothing in them is trusted). On failure `out_snapshot` is left empty
+// NOTE: `out_snapshot` can't be `base`
+bool itu_snapshot_delta_decode(ITU_Snapshot* base, Uint8* delta, Uint64 delta_size, ITU_Snapshot* out_snapshot)
+{
+	SDL_assert(base != out_snapshot);
+
+	// NOTE: nothing usable until the end, so a failure halfway through can't be mistaken for a snapshot
+	out_snapshot->size = 0;
+
+	Uint64 size;
+	if(delta_size < sizeof(Uint64))
+		return false;
+	SDL_memcpy(&size, delta, sizeof(Uint64));
+	if(size > out_snapshot->capacity || size % 8 != 0)
+		return false;
+
+	Uint64* words      = (Uint64*)out_snapshot->data;
+	Uint64* words_base = (Uint64*)base->data;
+	Uint64 words_count      = size / 8;
+	Uint64 words_base_count = base->size / 8;
+
+	Uint64 offset = sizeof(Uint64);
+	Uint64 i = 0;
+	while(offset < delta_size)
+	{
+		Uint32 unchanged_count, changed_count;
+		if(delta_size - offset < sizeof(Uint32) * 2)
+			return false;
+		SDL_memcpy(&unchanged_count, delta + offset, sizeof(Uint32));
+		SDL_memcpy(&changed_count, delta + offset + sizeof(Uint32), sizeof(Uint32));
+		offset += sizeof(Uint32) * 2;
+
+		// NOTE: counts are 32 bit, so these can't overflow
+		if((Uint64)unchanged_count + changed_count > words_count - i)
+			return false;
+		if((Uint64)changed_count * sizeof(Uint64) > delta_size - offset)
+			return false;
+
+		for(Uint32 j = 0; j < unchanged_count; ++j, ++i)
+			words[i] = i < words_base_count ? words_base[i] : 0;
+
+		for(Uint32 j = 0; j < changed_count; ++j, ++i)
+		{
+			Uint64 word;
+			SDL_memcpy(&word, delta + offset, sizeof(Uint64));
+			offset += sizeof(Uint64);
+			words[i] = word ^ (i < words_base_count ? words_base[i] : 0);
+		}
+	}
+	if(i != words_count)
+		return false;
+
+	out_snapshot->size = size;
+	if(!itu_snapshot_is_valid(out_snapshot) || !itu_snapshot_contents_are_valid(out_snapshot))
+	{
+		out_snapshot->size = 0;
+		return false;
+	}
+	return true;
+}
 
 void itu_debug_ui_widget_entityid(const char* label, ITU_EntityId id)
 {
 	if(!itu_entity_is_valid(id))
+	{
 		ImGui::LabelText(label, "INVALID ENTITY");
-	else
-		ImGui::LabelText(label, "%s (%d, %d)", ctx.entities_debug_names[id.index].value, id.generation, id.index);
+		return;
+	}
+
+	int pos_debug_name = stbds_hmgeti(ctx.entities_debug_names, id);
+	const char* debug_name = pos_debug_name >= 0 ? ctx.entities_debug_names[pos_debug_name].value : "(unnamed)";
+	ImGui::LabelText(label, "%s (%d, %d)", debug_name, id.generation, id.index);
+}
+
+void itu_debug_ui_widget_weakref(const char* label, ITU_WeakRef ref)
+{
+	itu_debug_ui_widget_entityid(label, itu_weakref_get(ref));
 }
\ No newline at end of file
@@ -9,58 +9,308 @@
 #include <itu_lib_engine.hpp>
 #endif
 
-// NOTE: this is decided by the size of the `component_mask` type (Uint64).
-//       DO NOT CHANGE THIS unless you also increase the size of the bitmask!
-#define COMPONENTS_COUNT_MAX  64
-// NOTE: this is decided by the size of the `tag_mask` tupe (Uint64).
-//       DO NOT CHANGE THIS unless you also increase the size of the bitmask!
-#define TAGS_COUNT_MAX        64
+// size of component and tag signatures (`ITU_Mask`). Can be 64, 128 or 256
+// NOTE: define it before including this file to change it. Wider masks cost a bit more memory per entity/archetype/system,
+//       and signature checks are done with SSE2/AVX2 when available
+#ifndef ITU_SIGNATURE_BITS
+#define ITU_SIGNATURE_BITS 64
+#endif
+
+#if ITU_SIGNATURE_BITS != 64 && ITU_SIGNATURE_BITS != 128 && ITU_SIGNATURE_BITS != 256
+#error "ITU_SIGNATURE_BITS must be 64, 128 or 256"
+#endif
+
+#define ITU_MASK_WORDS (ITU_SIGNATURE_BITS / 64)
+
+#if ITU_SIGNATURE_BITS > 64 && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ITU_MASK_SSE2
+#include <emmintrin.h>
+#endif
+#if ITU_SIGNATURE_BITS == 256 && defined(__AVX2__)
+#define ITU_MASK_AVX2
+#include <immintrin.h>
+#endif
+
+// NOTE: this is decided by the size of the `component_mask` type (ITU_Mask).
+//       Change ITU_SIGNATURE_BITS to increase it
+#define COMPONENTS_COUNT_MAX  ITU_SIGNATURE_BITS
+// NOTE: this is decided by the size of the `tag_mask` type (ITU_Mask).
+//       Change ITU_SIGNATURE_BITS to increase it
+#define TAGS_COUNT_MAX        ITU_SIGNATURE_BITS
+#define RELATIONS_COUNT_MAX   16
 
 #define SYSTEMS_COUNT_MAX     64
 #define SYSTEM_COMPONENTS_MAX  8
 #define SYSTEM_TAGS_MAX        8
-#define ENTITIES_COUNT_MAX 4096 * 4
+#define SYSTEM_CHUNK_SIZE_MIN 256 // smallest slice of entities handed to a chunked system (smaller ones are not worth the scheduling overhead)
+
+#define COMPONENT_CAPACITY_DEFAULT 256 // initial number of elements of a component pool, if not specified. Pools grow as needed
+#define COMPONENT_PAGE_SHIFT        10
+#define COMPONENT_PAGE_SIZE        (1 << COMPONENT_PAGE_SHIFT) // number of entity indices covered by a single page of a component pool lookup
+#define COMPONENT_LOC_NONE         ((Uint32)-1)
+#define COMPONENT_SORT_STEPS_DEFAULT 1024 // max number of elements a pool looks at each frame while sorting itself
 
 #define ITU_ENTITY_ID_NULL { (Uint32)-1, (Uint32)-1 }
 
 // unique identifier for an entity. This sould be treated as an opaque handle
+// NOTE: `handle` packs both fields, so ids can be compared (and validated) with a single 64 bit comparison
 struct ITU_EntityId
 {
-	Uint32 generation;
-	Uint32 index;
+	union
+	{
+		struct
+		{
+			Uint32 generation;
+			Uint32 index;
+		};
+		Uint64 handle;
+	};
 };
 
+// slot in the weak references table (see `itu_weakref_create()`)
+typedef Uint32 ITU_WeakRef;
+
 typedef Uint8 ITU_ComponentType;
 typedef Uint8 ITU_TagType;
+typedef Uint8 ITU_RelationType;
+
+// fixed size bitset, used for component and tag signatures
+// NOTE: can be built from a Uint64 (for the first 64 bits), so plain numbers like `0` still work as masks
+struct ITU_Mask
+{
+	Uint64 words[ITU_MASK_WORDS];
+
+	ITU_Mask() = default;
+	ITU_Mask(Uint64 v)
+	{
+		words[0] = v;
+		for(int i = 1; i < ITU_MASK_WORDS; ++i)
+			words[i] = 0;
+	}
+
+	ITU_Mask operator|(ITU_Mask b) const
+	{
+		ITU_Mask ret;
+		for(int i = 0; i < ITU_MASK_WORDS; ++i)
+			ret.words[i] = words[i] | b.words[i];
+		return ret;
+	}
+
+	ITU_Mask operator&(ITU_Mask b) const
+	{
+		ITU_Mask ret;
+		for(int i = 0; i < ITU_MASK_WORDS; ++i)
+			ret.words[i] = words[i] & b.words[i];
+		return ret;
+	}
+
+	ITU_Mask operator~() const
+	{
+		ITU_Mask ret;
+		for(int i = 0; i < ITU_MASK_WORDS; ++i)
+			ret.words[i] = ~words[i];
+		return ret;
+	}
+
+	ITU_Mask operator|=(ITU_Mask b)
+	{
+		*this = *this | b;
+		return *this;
+	}
+
+	ITU_Mask operator&=(ITU_Mask b)
+	{
+		*this = *this & b;
+		return *this;
+	}
+
+	bool operator==(ITU_Mask b) const
+	{
+		Uint64 diff = 0;
+		for(int i = 0; i < ITU_MASK_WORDS; ++i)
+			diff |= words[i] ^ b.words[i];
+		return diff == 0;
+	}
+
+	bool operator!=(ITU_Mask b) const
+	{
+		return !(*this == b);
+	}
+};
+
+inline ITU_Mask itu_mask_bit(int bit)
+{
+	ITU_Mask ret = 0;
+	ret.words[bit >> 6] = 1ull << (bit & 63);
+	return ret;
+}
+
+inline bool itu_mask_test(const ITU_Mask& mask, int bit)
+{
+	return (mask.words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+inline bool itu_mask_is_zero(const ITU_Mask& mask)
+{
+	Uint64 any = 0;
+	for(int i = 0; i < ITU_MASK_WORDS; ++i)
+		any |= mask.words[i];
+	return any == 0;
+}
+
+inline bool itu_mask_intersects(const ITU_Mask& a, const ITU_Mask& b)
+{
+	Uint64 any = 0;
+	for(int i = 0; i < ITU_MASK_WORDS; ++i)
+		any |= a.words[i] & b.words[i];
+	return any != 0;
+}
+
+// true if all the bits of `sub` are also set in `mask`. This is THE signature check, so it gets the SIMD treatment
+inline bool itu_mask_contains(const ITU_Mask& mask, const ITU_Mask& sub)
+{
+#if defined(ITU_MASK_AVX2)
+	__m256i m = _mm256_loadu_si256((const __m256i*)mask.words);
+	__m256i s = _mm256_loadu_si256((const __m256i*)sub.words);
+	return _mm256_testc_si256(m, s); // (~m & s) == 0
+#elif defined(ITU_MASK_SSE2)
+	int equal = 0xffff;
+	for(int i = 0; i < ITU_MASK_WORDS; i += 2)
+	{
+		__m128i m = _mm_loadu_si128((const __m128i*)(mask.words + i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(sub.words + i));
+		equal &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(m, s), s));
+	}
+	return equal == 0xffff;
+#else
+	Uint64 missing = 0;
+	for(int i = 0; i < ITU_MASK_WORDS; ++i)
+		missing |= sub.words[i] & ~mask.words[i];
+	return missing == 0;
+#endif
+}
+
+// ad-hoc query over all entities, usable anywhere (see `itu_query_create()`)
+struct ITU_Query;
+
+// template to spawn many entities with the same components and tags (see `itu_prefab_instantiate()`)
+struct ITU_Prefab;
+
+// preallocated buffer holding a copy of the whole entity storage (see `itu_sys_estorage_snapshot()`)
+struct ITU_Snapshot
+{
+	Uint8* data;
+	Uint64 size;     // bytes used by the last snapshot (0 if empty)
+	Uint64 capacity;
+};
 
 // signature for a system-like update function
 typedef void (*ITU_SystemUpdateFunction)(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count);
 
+// same as `ITU_SystemUpdateFunction`, but it only receives a contiguous slice of the matching entities.
+// The same system can be called on different slices at the same time from different threads
+typedef ITU_SystemUpdateFunction ITU_SystemUpdateChunkFunction;
+
 // signature for a component debug UI render function
 typedef void (*ITU_ComponendDebugUIRender)(SDLContext* context, void* data);
 
+// signature for a function fixing up a component after restoring a snapshot or loading a world file (ie, to re-resolve pointers,
+// or to check that what it owns outside of the entity storage still exists). Returns false if the component can't be brought back
+// (it is then removed, make sure `data` is safe for its OnRemove observers)
+typedef bool (*ITU_ComponentLoadFixupFunction)(ITU_EntityId id, void* data);
+
+// signature for the function returning the key a component pool is sorted by (see `component_sort_key()`)
+typedef Uint64 (*ITU_ComponentSortKeyFunction)(void* data);
+
+enum ITU_ObserverEvent
+{
+	ITU_OBSERVER_ON_ADD,     // component added (directly or by instantiating a prefab)
+	ITU_OBSERVER_ON_REMOVE,  // component removed (directly or because the entity was destroyed)
+	ITU_OBSERVER_ON_DESTROY, // entity destroyed (not tied to a component type)
+	ITU_OBSERVER_EVENT_MAX
+};
+
+// signature for an observer, called once per batch with all the entities the event happened to.
+// `components_data` is only set for ITU_OBSERVER_ON_REMOVE: a copy of the removed components (`count` elements, tightly packed),
+// since by the time observers run they are gone from the entity
+typedef void (*ITU_ObserverFunction)(ITU_EntityId* entity_ids, void* components_data, int count);
+
 struct ITU_SystemDef
 {
 	const char* name;
 	ITU_SystemUpdateFunction fn_update;
-	Uint64 component_mask;
-	Uint64 tag_mask;
+	ITU_Mask component_mask;
+	ITU_Mask tag_mask;
+
+	// components the system reads/writes, used to decide which systems can run in parallel.
+	// If both are 0, the system is considered "exclusive": it runs alone on the main thread (always the case for systems that render)
+	// NOTE: structural changes (create/destroy entities, add/remove components and tags) requested by any system are deferred
+	//       until the end of its phase, so they are safe even from systems running in parallel
+	ITU_Mask component_mask_read;
+	ITU_Mask component_mask_write;
+
+	// if set (instead of `fn_update`), matching entities are split in chunks and processed in parallel.
+	// All chunks are done before any conflicting system runs
+	ITU_SystemUpdateChunkFunction fn_update_chunk;
+};
+
+struct ITU_QueryDef
+{
+	ITU_Mask with;         // components the entities must have
+	ITU_Mask without;      // components the entities must NOT have
+	ITU_Mask optional;     // components that can be accessed while iterating if present (but don't affect matching)
+	ITU_Mask tags_with;
+	ITU_Mask tags_without;
 };
 
-#define register_component(T) ITU_ComponentType ITU_COMPONENT_TYPE_##T; const char* ITU_COMPONENT_NAME_##T = #T;
-#define enable_component(T) itu_sys_estorage_add_component_pool(sizeof(T), ENTITIES_COUNT_MAX, &ITU_COMPONENT_TYPE_##T, ITU_COMPONENT_NAME_##T)
+// NOTE: this is meant to be used as
+//       ITU_QueryIter it = itu_query_iter(query);
+//       while(itu_query_next(&it))
+//       {
+//           Transform* transform = query_get_data(&it, Transform);
+//           ...
+//       }
+struct ITU_QueryIter
+{
+	ITU_Query* query;
+	int loc;
+	ITU_EntityId id; // current entity
+};
+
+// maps a component struct to its runtime type, specialized by `register_component()` (used by `ITU_View`)
+template<typename T> struct ITU_ComponentTrait;
+
+// NOTE: the forward declaration allows registering components before their definition (ie, the default ones below)
+#define register_component(T) ITU_ComponentType ITU_COMPONENT_TYPE_##T; const char* ITU_COMPONENT_NAME_##T = #T; \
+	struct T; template<> struct ITU_ComponentTrait<T> { static ITU_ComponentType type() { return ITU_COMPONENT_TYPE_##T; } };
+#define enable_component(T) itu_sys_estorage_add_component_pool(sizeof(T), alignof(T), COMPONENT_CAPACITY_DEFAULT, &ITU_COMPONENT_TYPE_##T, ITU_COMPONENT_NAME_##T)
+#define enable_component_with_capacity(T, capacity) itu_sys_estorage_add_component_pool(sizeof(T), alignof(T), capacity, &ITU_COMPONENT_TYPE_##T, ITU_COMPONENT_NAME_##T)
+
+#define component_sort_align(T, TPrimary) itu_sys_estorage_component_sort_align(ITU_COMPONENT_TYPE_##T, ITU_COMPONENT_TYPE_##TPrimary, COMPONENT_SORT_STEPS_DEFAULT)
+#define component_sort_key(T, fn_sort_key) itu_sys_estorage_component_sort_key(ITU_COMPONENT_TYPE_##T, fn_sort_key, COMPONENT_SORT_STEPS_DEFAULT)
 
 #define add_component_debug_ui_render(T, fn_debug_ui_render) itu_sys_estorage_add_component_debug_ui_render( ITU_COMPONENT_TYPE_##T, fn_debug_ui_render);
+#define add_component_load_fixup(T, fn_load_fixup) itu_sys_estorage_add_component_load_fixup(ITU_COMPONENT_TYPE_##T, fn_load_fixup);
+#define add_observer_on_add(T, fn_observer) itu_sys_estorage_add_observer(ITU_OBSERVER_ON_ADD, ITU_COMPONENT_TYPE_##T, fn_observer);
+#define add_observer_on_remove(T, fn_observer) itu_sys_estorage_add_observer(ITU_OBSERVER_ON_REMOVE, ITU_COMPONENT_TYPE_##T, fn_observer);
+#define add_observer_on_destroy(fn_observer) itu_sys_estorage_add_observer(ITU_OBSERVER_ON_DESTROY, 0, fn_observer);
 
 #define entity_get_data(id, T) (T*)itu_entity_data_get((id), ITU_COMPONENT_TYPE_##T)
+#define entity_get_data_mut(id, T) (T*)itu_entity_data_get_mut((id), ITU_COMPONENT_TYPE_##T)
+#define entity_component_changed(id, T) itu_entity_component_changed((id), ITU_COMPONENT_TYPE_##T)
 
 #define add_system(fn_update, component_mask, tag_mask) itu_sys_estorage_add_system({ #fn_update, fn_update, component_mask, tag_mask })
+#define add_system_rw(fn_update, component_mask, tag_mask, read_mask, write_mask) itu_sys_estorage_add_system({ #fn_update, fn_update, component_mask, tag_mask, read_mask, write_mask })
+#define add_system_chunked(fn_update_chunk, component_mask, tag_mask, read_mask, write_mask) itu_sys_estorage_add_system({ #fn_update_chunk, NULL, component_mask, tag_mask, read_mask, write_mask, fn_update_chunk })
 #define entity_add_component(id, T, value) { type_check_struct(T, value); itu_entity_component_add((id), ITU_COMPONENT_TYPE_##T, &value); }
+#define prefab_add_component(prefab, T, value) { type_check_struct(T, value); itu_prefab_component_add((prefab), ITU_COMPONENT_TYPE_##T, &value); }
 
-#define component_mask(T) (1ull << ITU_COMPONENT_TYPE_##T)
+#define query_get_data(iter, T) ((T*)itu_query_iter_data_get((iter), ITU_COMPONENT_TYPE_##T))
+
+#define component_mask(T) itu_mask_bit(ITU_COMPONENT_TYPE_##T)
 #define component_type(T) ITU_COMPONENT_TYPE_##T
 
-#define tag_mask(tag) (1ull << tag)
+#define tag_mask(tag) itu_mask_bit(tag)
 #define set_tag_debug_name(tag, name) 
 
 
@@ -70,22 +320,54 @@ register_component(Sprite)
 register_component(PhysicsData)
 register_component(PhysicsStaticData)
 register_component(ShapeData)
+register_component(TransformParent)
+register_component(TransformWorld)
+register_component(Tilemap)
 
-void itu_sys_estorage_init(int starting_entities_count, bool enable_standard_components);
+void itu_sys_estorage_init(SDLContext* context, int starting_entities_count, bool enable_standard_components);
+void itu_sys_estorage_shutdown();
 void itu_sys_estorage_clear_all_entities();
 void itu_sys_estorage_add_system(ITU_SystemDef system_def);
 void itu_sys_estorage_set_systems(ITU_SystemDef* systems, int systems_count);
 void itu_sys_estorage_systems_update(SDLContext* context);
+void itu_sys_estorage_defer_begin();
+void itu_sys_estorage_defer_end();
+void itu_sys_estorage_commands_flush();
+
+// observers: callbacks for components being added/removed and entities being destroyed.
+// Events are not reported inline, they are queued and dispatched in batches (one call per observer with all the entities at once)
+// right after deferred structural changes are played back, and at the start of `itu_sys_estorage_systems_update()` for changes
+// done outside of systems. Structural changes requested by observers are deferred too, and dispatched in the same round
+// NOTE: within a batch, events are grouped by type (all adds, then all removes, then all destroys), not in the order they happened.
+//       An entity can be already gone by the time its OnAdd is dispatched, check with `itu_entity_is_valid()` if it matters
+// NOTE: `itu_sys_estorage_clear_all_entities()` reports every component as removed and every entity as destroyed (dispatched before it returns).
+//       `itu_sys_estorage_restore()` reports only what is not in the snapshot (see its comment)
+void itu_sys_estorage_add_observer(ITU_ObserverEvent event, ITU_ComponentType component_type, ITU_ObserverFunction fn_observer);
+void itu_sys_estorage_observers_dispatch();
+void itu_sys_estorage_parallel_for(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count, ITU_SystemUpdateChunkFunction fn_update_chunk);
+void itu_sys_estorage_component_sort_align(ITU_ComponentType component_type, ITU_ComponentType primary_type, int steps_per_frame);
+void itu_sys_estorage_component_sort_key(ITU_ComponentType component_type, ITU_ComponentSortKeyFunction fn_sort_key, int steps_per_frame);
+void itu_sys_estorage_components_sort_update();
+Uint32 itu_sys_estorage_world_version();
+Uint32 itu_sys_estorage_last_run_version();
 
 void itu_sys_estorage_tag_set_debug_name(int tag, const char* tag_debug_name);
+ITU_EntityId* itu_sys_estorage_tag_get_entities(ITU_TagType tag, int* out_count);
+void itu_sys_estorage_relation_set_debug_name(ITU_RelationType relation, const char* relation_debug_name);
+void itu_sys_estorage_relation_set_destroy_with_target(ITU_RelationType relation, bool destroy_with_target);
 void itu_sys_estorage_debug_render(SDLContext* context);
 
 ITU_EntityId itu_entity_create();
+void  itu_entity_create_many     (ITU_EntityId* out_ids, int count);
 void  itu_entity_set_debug_name  (ITU_EntityId id, const char* debug_name);
 bool  itu_entity_equals          (ITU_EntityId a, ITU_EntityId b);
 bool  itu_entity_is_valid        (ITU_EntityId id);
 void  itu_entity_id_to_stringid  (ITU_EntityId id, char* buffer, int max_len);
+void  itu_entity_ids_resolve     (ITU_EntityId* ids, int count);
 void* itu_entity_data_get        (ITU_EntityId id, ITU_ComponentType component_type);
+void* itu_entity_data_get_mut    (ITU_EntityId id, ITU_ComponentType component_type);
+bool  itu_entity_component_changed(ITU_EntityId id, ITU_ComponentType component_type);
+bool  itu_entity_component_changed_since(ITU_EntityId id, ITU_ComponentType component_type, Uint32 version);
 void  itu_entity_tag_add         (ITU_EntityId id, ITU_TagType tag);
 void  itu_entity_tag_remove      (ITU_EntityId id, ITU_TagType tag);
 bool  itu_entity_tag_has         (ITU_EntityId id, ITU_TagType tag);
@@ -93,5 +375,136 @@ void  itu_entity_component_add   (ITU_EntityId id, ITU_ComponentType component_t
 void  itu_entity_component_remove(ITU_EntityId id, ITU_ComponentType component_type);
 void  itu_entity_destroy         (ITU_EntityId id);
 
+// relations: links between two entities, like `(TARGETS, enemy)` or `(CHILD_OF, parent)`. Each entity can have at most one target per relation,
+// and every relation keeps a reverse index, so finding all the sources pointing at a target only costs as much as the number of sources.
+// Pairs involving an entity are removed when it's destroyed (or, for relations set to destroy with target, its sources are destroyed too)
+// NOTE: like tags, relation types are just small integers picked by the user (< RELATIONS_COUNT_MAX)
+void  itu_entity_relation_set    (ITU_EntityId source, ITU_RelationType relation, ITU_EntityId target);
+void  itu_entity_relation_remove (ITU_EntityId source, ITU_RelationType relation);
+ITU_EntityId itu_entity_relation_get(ITU_EntityId source, ITU_RelationType relation);
+int   itu_entity_relation_get_sources(ITU_EntityId target, ITU_RelationType relation, ITU_EntityId* out_ids, int out_ids_capacity);
+
+// weak references: shared slots holding an entity id, that read as `ITU_ENTITY_ID_NULL` once the entity is gone.
+// The whole table is checked in a single pass whenever entities might have been destroyed (at most once per phase while systems run),
+// so reading a reference is just an array lookup
+ITU_WeakRef  itu_weakref_create (ITU_EntityId target);
+void         itu_weakref_destroy(ITU_WeakRef ref);
+void         itu_weakref_set    (ITU_WeakRef ref, ITU_EntityId target);
+ITU_EntityId itu_weakref_get    (ITU_WeakRef ref);
+void         itu_weakref_get_many(ITU_WeakRef* refs, int count, ITU_EntityId* out_ids);
+
+ITU_Prefab* itu_prefab_create();
+void itu_prefab_destroy      (ITU_Prefab* prefab);
+void itu_prefab_component_add(ITU_Prefab* prefab, ITU_ComponentType component_type, void* in_data_copy);
+void itu_prefab_tag_add      (ITU_Prefab* prefab, ITU_TagType tag);
+void itu_prefab_instantiate  (ITU_Prefab* prefab, ITU_EntityId* out_ids, int count);
+
+// results are cached and only rebuilt when needed (after an entity is created/destroyed, or its components/tags changed)
+ITU_Query*    itu_query_create(ITU_QueryDef query_def);
+void          itu_query_destroy(ITU_Query* query);
+void          itu_query_refresh(ITU_Query* query);
+ITU_EntityId* itu_query_get_entities(ITU_Query* query, int* out_count);
+ITU_QueryIter itu_query_iter(ITU_Query* query);
+bool          itu_query_next(ITU_QueryIter* iter);
+void*         itu_query_iter_data_get(ITU_QueryIter* iter, ITU_ComponentType component_type);
+
+// save/restore the whole entity storage (ie, for rollback or level restarts)
+// NOTE: components owning resources outside of the entity storage (bodies, tiles, ...) must not be restored without a load fixup
+ITU_Snapshot* itu_snapshot_create(Uint64 capacity);
+void          itu_snapshot_destroy(ITU_Snapshot* snapshot);
+Uint64        itu_sys_estorage_snapshot_size();
+bool          itu_sys_estorage_snapshot(ITU_Snapshot* snapshot);
+void          itu_sys_estorage_restore(ITU_Snapshot* snapshot);
+Uint64        itu_snapshot_delta_encode(ITU_Snapshot* base, ITU_Snapshot* snapshot, Uint8* out_delta, Uint64 out_delta_capacity);
+bool          itu_snapshot_delta_decode(ITU_Snapshot* base, Uint8* delta, Uint64 delta_size, ITU_Snapshot* out_snapshot);
+bool          itu_snapshot_is_valid(ITU_Snapshot* snapshot);
+bool          itu_snapshot_contents_are_valid(ITU_Snapshot* snapshot);
+
+// versioned world files, rejected if any component layout changed since they were saved
+bool itu_sys_estorage_save(const char* path);
+bool itu_sys_estorage_load(const char* path);
+SDL_Texture* itu_sys_estorage_load_texture(SDL_Texture* texture);
+void itu_sys_estorage_add_component_load_fixup(ITU_ComponentType component_type, ITU_ComponentLoadFixupFunction fn_load_fixup);
+
 void itu_debug_ui_widget_entityid(const char* label, ITU_EntityId id);
+void itu_debug_ui_widget_weakref(const char* label, ITU_WeakRef ref);
+
+// raw access to a component pool, see `ITU_View`
+struct ITU_ComponentPoolView
+{
+	Uint32** loc_pages; // see `COMPONENT_PAGE_SIZE`
+	void*    data;
+	Uint32*  versions;
+};
+
+ITU_ComponentPoolView itu_component_pool_view(ITU_ComponentType component_type);
+
+// position of T in Ts (compile time)
+template<typename T, typename... Ts> struct ITU_TypeIndex;
+template<typename T, typename... Ts> struct ITU_TypeIndex<T, T, Ts...> { static const int value = 0; };
+template<typename T, typename U, typename... Ts> struct ITU_TypeIndex<T, U, Ts...> { static const int value = 1 + ITU_TypeIndex<T, Ts...>::value; };
+
+// typed access to multiple components at once, skipping all the checks done by `entity_get_data()`.
+// Meant to be used inside systems, with the entity list the system receives:
+//
+//     ITU_View<Transform, Sprite> view;
+//     view.each(entity_ids, entity_ids_count, [&](ITU_EntityId id, Transform& transform, Sprite& sprite) { ... });
+//
+// NOTE: entities MUST have all the components in the view (always true for entities matching a system that requires them).
+//       The view caches pool pointers, so it must not outlive any structural change (all of them are deferred while systems run)
+// NOTE: `get()` and `each()` don't mark anything as changed, use `get_mut()` for writes other systems should know about
+template<typename... Ts>
+struct ITU_View
+{
+	ITU_ComponentPoolView pools[sizeof...(Ts)];
+	Uint32 world_version;
+	Uint32 last_run_version;
+
+	ITU_View()
+	{
+		ITU_ComponentType types[] = { ITU_ComponentTrait<Ts>::type()... };
+		for(int i = 0; i < (int)sizeof...(Ts); ++i)
+			pools[i] = itu_component_pool_view(types[i]);
+		world_version = itu_sys_estorage_world_version();
+		last_run_version = itu_sys_estorage_last_run_version();
+	}
+
+	template<typename T>
+	Uint32 loc(ITU_EntityId id)
+	{
+		ITU_ComponentPoolView* pool = &pools[ITU_TypeIndex<T, Ts...>::value];
+		Uint32 ret = pool->loc_pages[id.index >> COMPONENT_PAGE_SHIFT][id.index & (COMPONENT_PAGE_SIZE - 1)];
+		SDL_assert(ret != COMPONENT_LOC_NONE);
+		return ret;
+	}
+
+	template<typename T>
+	T& get(ITU_EntityId id)
+	{
+		return ((T*)pools[ITU_TypeIndex<T, Ts...>::value].data)[loc<T>(id)];
+	}
+
+	template<typename T>
+	T& get_mut(ITU_EntityId id)
+	{
+		ITU_ComponentPoolView* pool = &pools[ITU_TypeIndex<T, Ts...>::value];
+		Uint32 l = loc<T>(id);
+		pool->versions[l] = world_version;
+		return ((T*)pool->data)[l];
+	}
+
+	// true if the component was added or written (with a mutable accessor) since the last time the current system ran
+	template<typename T>
+	bool changed(ITU_EntityId id)
+	{
+		return pools[ITU_TypeIndex<T, Ts...>::value].versions[loc<T>(id)] > last_run_version;
+	}
+
+	template<typename F>
+	void each(ITU_EntityId* entity_ids, int entity_ids_count, F fn)
+	{
+		for(int i = 0; i < entity_ids_count; ++i)
+			fn(entity_ids[i], get<Ts>(entity_ids[i])...);
+	}
+};
 #endif // ITU_ENTITY_STORAGE_HPP
@@ -0,0 +1,177 @@
+// itu_lib_arena.hpp
+// linear (bump) allocator, for data that all dies at the same time
+// - `itu_lib_arena_alloc()` just moves a pointer forward, there is no way to free a single allocation
+// - `itu_lib_arena_reset()` frees everything at once, but keeps the memory around for the next round
+// - if an allocation doesn't fit, a new block is chained. On reset, chained blocks are merged into a single bigger one,
+//   so after a few rounds the arena settles on a single block and stops allocating entirely
+//
+// NOTE: not thread safe, only allocate from the thread that owns the arena (for engine arenas, the main thread)
+// NOTE: a zero-initialized arena is valid, it allocates its first block on the first allocation
+
+#ifndef ITU_LIB_ARENA_HPP
+#define ITU_LIB_ARENA_HPP
+
+#ifndef ITU_UNITY_BUILD
+#include <SDL3/SDL.h>
+#include <itu_common.hpp>
+#endif
+
+#define ITU_ARENA_BLOCK_SIZE_DEFAULT KB(64)
+#define ITU_ARENA_ALIGN_DEFAULT      16
+
+struct ITU_ArenaBlock
+{
+	ITU_ArenaBlock* next;
+	Uint64 size; // usable bytes, right after the header
+	Uint64 used;
+};
+
+struct ITU_Arena
+{
+	ITU_ArenaBlock* block_first;
+	ITU_ArenaBlock* block_curr;
+	Uint64 block_size; // minimum size of new blocks (ITU_ARENA_BLOCK_SIZE_DEFAULT if 0)
+	Uint64 used_peak;  // highest amount of memory ever used at the same time, for stats
+};
+
+void  itu_lib_arena_init(ITU_Arena* arena, Uint64 size);
+void  itu_lib_arena_destroy(ITU_Arena* arena);
+void* itu_lib_arena_alloc(ITU_Arena* arena, Uint64 size, Uint64 align);
+char* itu_lib_arena_strdup(ITU_Arena* arena, const char* str);
+void  itu_lib_arena_reset(ITU_Arena* arena);
+Uint64 itu_lib_arena_used(ITU_Arena* arena);
+
+// allocates (uninitialized) space for `count` elements of type `T`
+#define arena_alloc_array(arena, T, count) ((T*)itu_lib_arena_alloc((arena), sizeof(T) * (count), alignof(T)))
+
+#endif // ITU_LIB_ARENA_HPP
+
+#if (defined ITU_LIB_ARENA_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
+
+// NOTE: the header is padded to the default alignment, so that data starts aligned too
+#define ITU_ARENA_BLOCK_HEADER_SIZE ((sizeof(ITU_ArenaBlock) + ITU_ARENA_ALIGN_DEFAULT - 1) & ~(Uint64)(ITU_ARENA_ALIGN_DEFAULT - 1))
+
+ITU_ArenaBlock* itu_lib_arena_block_create(Uint64 size)
+{
+	ITU_ArenaBlock* ret = (ITU_ArenaBlock*)SDL_aligned_alloc(ITU_ARENA_ALIGN_DEFAULT, ITU_ARENA_BLOCK_HEADER_SIZE + size);
+	VALIDATE_PANIC(ret);
+
+	ret->next = NULL;
+	ret->size = size;
+	ret->used = 0;
+	return ret;
+}
+
+unsigned char* itu_lib_arena_block_data(ITU_ArenaBlock* block)
+{
+	return (unsigned char*)block + ITU_ARENA_BLOCK_HEADER_SIZE;
+}
+
+// preallocates a single block of `size` bytes
+void itu_lib_arena_init(ITU_Arena* arena, Uint64 size)
+{
+	SDL_zerop(arena);
+	arena->block_size = size;
+	arena->block_first = itu_lib_arena_block_create(size);
+	arena->block_curr = arena->block_first;
+}
+
+void itu_lib_arena_destroy(ITU_Arena* arena)
+{
+	ITU_ArenaBlock* block = arena->block_first;
+	while(block)
+	{
+		ITU_ArenaBlock* next = block->next;
+		SDL_aligned_free(block);
+		block = next;
+	}
+	SDL_zerop(arena);
+}
+
+// `align` must be a power of 2 (0 means ITU_ARENA_ALIGN_DEFAULT)
+void* itu_lib_arena_alloc(ITU_Arena* arena, Uint64 size, Uint64 align)
+{
+	if(align == 0)
+		align = ITU_ARENA_ALIGN_DEFAULT;
+	SDL_assert((align & (align - 1)) == 0);
+	SDL_assert(align <= ITU_ARENA_ALIGN_DEFAULT);
+
+	if(!arena->block_size)
+		arena->block_size = ITU_ARENA_BLOCK_SIZE_DEFAULT;
+
+	ITU_ArenaBlock* block = arena->block_curr;
+	while(true)
+	{
+		if(!block)
+		{
+			block = itu_lib_arena_block_create(SDL_max(arena->block_size, size + align));
+			if(arena->block_curr)
+				arena->block_curr->next = block;
+			else
+				arena->block_first = block;
+		}
+
+		Uint64 offset = (block->used + align - 1) & ~(align - 1);
+		if(offset + size <= block->size)
+		{
+			block->used = offset + size;
+			arena->block_curr = block;
+			break;
+		}
+
+		// NOTE: after a reset blocks are reused in order, so the next one may already be there
+		arena->block_curr = block;
+		block = block->next;
+	}
+
+	Uint64 used = itu_lib_arena_used(arena);
+	arena->used_peak = SDL_max(arena->used_peak, used);
+
+	return itu_lib_arena_block_data(arena->block_curr) + arena->block_curr->used - size;
+}
+
+char* itu_lib_arena_strdup(ITU_Arena* arena, const char* str)
+{
+	Uint64 len = SDL_strlen(str);
+	char* ret = (char*)itu_lib_arena_alloc(arena, len + 1, 1);
+	SDL_memcpy(ret, str, len + 1);
+	return ret;
+}
+
+void itu_lib_arena_reset(ITU_Arena* arena)
+{
+	if(!arena->block_first)
+		return;
+
+	// merge all blocks into one big enough to hold everything, so that next time we don't need to chain anything
+	if(arena->block_first->next)
+	{
+		Uint64 size = 0;
+		for(ITU_ArenaBlock* block = arena->block_first; block; block = block->next)
+			size += block->size;
+
+		Uint64 used_peak = arena->used_peak;
+		itu_lib_arena_destroy(arena);
+		itu_lib_arena_init(arena, size);
+		arena->used_peak = used_peak;
+		return;
+	}
+
+	arena->block_first->used = 0;
+	arena->block_curr = arena->block_first;
+}
+
+// bytes currently allocated (including alignment padding)
+Uint64 itu_lib_arena_used(ITU_Arena* arena)
+{
+	Uint64 ret = 0;
+	for(ITU_ArenaBlock* block = arena->block_first; block; block = block->next)
+	{
+		ret += block->used;
+		if(block == arena->block_curr)
+			break;
+	}
+	return ret;
+}
+
+#endif // (defined ITU_LIB_ARENA_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
@@ -6,6 +6,9 @@ void itu_debug_ui_render_sprite(SDLContext* context, void* data);
 void itu_debug_ui_render_physicsdata(SDLContext* context, void* data);
 void itu_debug_ui_render_physicsstaticdata(SDLContext* context, void* data);
 void itu_debug_ui_render_shapedata(SDLContext* context, void* data);
+void itu_debug_ui_render_transformparent(SDLContext* context, void* data);
+void itu_debug_ui_render_transformworld(SDLContext* context, void* data);
+void itu_debug_ui_render_tilemap(SDLContext* context, void* data);
 
 #endif // ITU_LIB_DEBUG_UI_HPP
 
@@ -43,6 +46,13 @@ void itu_debug_ui_render_sprite(SDLContext* context, void* data)
 
 	ImGui::ColorEdit4("tint", &data_sprite->tint.r);
 	ImGui::Checkbox("Flip Hor.", &data_sprite->flip_horizontal);
+
+	static const char* blend_names[ITU_SPRITE_BLEND_MAX] = { "default", "none", "alpha", "add", "mod", "mul" };
+	int blend = data_sprite->blend;
+	if(ImGui::Combo("blend", &blend, blend_names, ITU_SPRITE_BLEND_MAX))
+		data_sprite->blend = (Uint8)blend;
+	ImGui::InputScalar("layer", ImGuiDataType_U8, &data_sprite->layer);
+	ImGui::DragFloat("depth", &data_sprite->depth);
 }
 
 void itu_debug_ui_render_physicsdata(SDLContext* context, void* data)
@@ -171,4 +181,31 @@ void itu_debug_ui_render_shapedata(SDLContext* context, void* data)
 		}
 }
 
+void itu_debug_ui_render_transformparent(SDLContext* context, void* data)
+{
+	TransformParent* data_parent = (TransformParent*)data;
+	ImGui::Text("parent %u (gen %u)", data_parent->parent.index, data_parent->parent.generation);
+}
+
+// read only, it's recomputed from `Transform` every time it changes
+void itu_debug_ui_render_transformworld(SDLContext* context, void* data)
+{
+	TransformWorld* data_world = (TransformWorld*)data;
+	ImGui::Text("position %.2f %.2f", data_world->transform.position.x, data_world->transform.position.y);
+	ImGui::Text("scale    %.2f %.2f", data_world->transform.scale.x, data_world->transform.scale.y);
+	ImGui::Text("rotation %.2f", data_world->transform.rotation * RAD_2_DEG);
+	ImGui::Text("depth    %d", data_world->depth);
+
+	itu_lib_render_draw_world_point(context, data_world->transform.position, 5, COLOR_GREEN);
+}
+
+// read only, except for the tiles (edit them with `itu_lib_tilemap_set()`)
+void itu_debug_ui_render_tilemap(SDLContext* context, void* data)
+{
+	Tilemap* data_tilemap = (Tilemap*)data;
+	ImGui::Text("size   %d x %d (%d x %d chunks)", data_tilemap->width, data_tilemap->height, data_tilemap->chunks_w, data_tilemap->chunks_h);
+	ImGui::Text("tiles  %d px, %.3f units", data_tilemap->tile_size_px, data_tilemap->tile_size);
+	ImGui::Text("chunks %d resident, %d baked last render", data_tilemap->chunks_resident_count, data_tilemap->bakes_count);
+}
+
 #endif // (defined ITU_LIB_DEBUG_UI_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <stb_ds.h>
 #include <stb_image.h>
 #include <itu_common.hpp>
+#include <itu_lib_arena.hpp>
 #include <imgui/imgui.h>
 #endif
 
@@ -97,11 +98,24 @@ struct SDLContext
 
 	stbds_hm(SDL_Keycode, BtnType) mappings_keyboard;
 	stbds_hm(Uint8, BtnType)       mappings_mouse;
+
+	// scratch memory, to avoid hitting the heap for short-lived data
+	ITU_Arena arena_frame; // reset at the end of every frame
+	ITU_Arena arena_level; // reset every time all entities are cleared (see `itu_sys_estorage_clear_all_entities()`)
 };
 
 #define TRANSFORM_DEFAULT Transform { { 0, 0 }, { 1, 1 }, 0 }
 
+// textures created with `texture_create()` are remembered together with their path,
+// so that they can be found again by it (ie, when loading world files, see `itu_sys_estorage_load()`)
+struct TextureInfo
+{
+	SDL_Texture* texture;
+	char* path;
+};
+
 void camera_set_active(SDLContext* context, Camera* camera);
+SDL_FRect camera_get_world_rect(SDLContext* context, Camera* camera);
 SDL_FRect rect_global_to_screen(SDLContext* context, SDL_FRect rect);
 vec2f point_global_to_screen(SDLContext* context, vec2f p);
 vec2f point_screen_to_global(SDLContext* context, vec2f p);
@@ -110,6 +124,8 @@ vec2f point_window_to_screen(SDLContext* context, vec2f p);
 void sdl_input_clear(SDLContext* context);
 void sdl_input_key_process(SDLContext* context, BtnType button_id, SDL_Event* event);
 SDL_Texture* texture_create(SDLContext* context, const char* path, SDL_ScaleMode mode);
+SDL_Texture* texture_find(const char* path);
+TextureInfo* texture_get_all(int* out_count);
 void sdl_set_render_draw_color(SDLContext* context, color c);
 void sdl_set_texture_tint(SDL_Texture* texture, color c);
 
@@ -117,6 +133,8 @@ void sdl_set_texture_tint(SDL_Texture* texture, color c);
 
 #if (defined ITU_LIB_ENGINE_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
 
+stbds_arr(TextureInfo) textures_created;
+
 void camera_set_active(SDLContext* context, Camera* camera)
 {
 	context->camera_active = camera;
@@ -141,6 +159,21 @@ SDL_FRect camera_get_viewport_rect(SDLContext* context, Camera* camera)
 	return rect;
 }
 
+// area of the world seen by the given camera (x and y are the bottom-left corner)
+SDL_FRect camera_get_world_rect(SDLContext* context, Camera* camera)
+{
+	vec2f camera_size;
+	camera_size.x = (context->window_w / camera->pixels_per_unit) * camera->normalized_screen_size.x / camera->zoom;
+	camera_size.y = (context->window_h / camera->pixels_per_unit) * camera->normalized_screen_size.y / camera->zoom;
+
+	SDL_FRect ret;
+	ret.x = camera->world_position.x - camera_size.x / 2;
+	ret.y = camera->world_position.y - camera_size.y / 2;
+	ret.w = camera_size.x;
+	ret.h = camera_size.y;
+	return ret;
+}
+
 // converts the given rect to the viewport of the given camera
 SDL_FRect rect_global_to_screen(SDLContext* context, SDL_FRect rect)
 {
@@ -366,9 +399,29 @@ SDL_Texture* texture_create(SDLContext* context, const char* path, SDL_ScaleMode
 	SDL_DestroySurface(surface);
 	stbi_image_free(pixels);
 
+	TextureInfo info;
+	info.texture = ret;
+	info.path = SDL_strdup(path);
+	stbds_arrput(textures_created, info);
+
 	return ret;
 }
 
+// NULL if no texture was created from `path`
+SDL_Texture* texture_find(const char* path)
+{
+	for(int i = 0; i < stbds_arrlen(textures_created); ++i)
+		if(SDL_strcmp(textures_created[i].path, path) == 0)
+			return textures_created[i].texture;
+	return NULL;
+}
+
+TextureInfo* texture_get_all(int* out_count)
+{
+	*out_count = stbds_arrlen(textures_created);
+	return textures_created;
+}
+
 void sdl_set_render_draw_color(SDLContext* context, color c)
 {
 	SDL_SetRenderDrawColorFloat(context->renderer, c.r, c.g, c.b, c.a);
@@ -0,0 +1,214 @@
+// itu_lib_jobs.hpp
+// minimal worker pool to run batches of independent jobs in parallel
+// - `itu_lib_jobs_run()` blocks until the whole batch is done (the calling thread helps out)
+// - batches are not reentrant: calling `itu_lib_jobs_run()` from inside a job runs the nested batch serially
+//
+// NOTE: this is meant for coarse jobs (whole systems, or big chunks of entities). Jobs are handed out
+//       one at a time under a lock, so thousands of tiny jobs would spend most of their time fighting over it
+
+#ifndef ITU_LIB_JOBS_HPP
+#define ITU_LIB_JOBS_HPP
+
+#ifndef ITU_UNITY_BUILD
+#include <SDL3/SDL.h>
+#include <itu_common.hpp>
+#endif
+
+#define ITU_JOBS_WORKERS_MAX 63
+
+typedef void (*ITU_JobFunction)(void* userdata);
+
+struct ITU_Job
+{
+	ITU_JobFunction fn;
+	void* userdata;
+};
+
+void itu_lib_jobs_init(int workers_count);
+void itu_lib_jobs_shutdown();
+void itu_lib_jobs_run(ITU_Job* jobs, int jobs_count);
+int  itu_lib_jobs_get_thread_index();
+int  itu_lib_jobs_get_threads_count();
+bool itu_lib_jobs_is_inside_job();
+
+#endif // ITU_LIB_JOBS_HPP
+
+#if (defined ITU_LIB_JOBS_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
+
+struct ITU_JobsContext
+{
+	SDL_Thread* workers[ITU_JOBS_WORKERS_MAX];
+	int workers_count;
+
+	SDL_Mutex*     mutex;
+	SDL_Condition* cond_work; // signaled when a new batch is available (or when shutting down)
+	SDL_Condition* cond_done; // signaled when the last job of the batch is completed
+
+	// current batch, all protected by `mutex`
+	ITU_Job* jobs;
+	int jobs_count;
+	int jobs_next;
+	int jobs_remaining;
+	bool running;
+	bool quit;
+};
+
+static ITU_JobsContext jobs_ctx;
+
+// 0 is the thread that called `itu_lib_jobs_init()`, workers go from 1 to `workers_count`
+static thread_local int jobs_thread_index;
+
+// > 0 while the current thread is executing a job
+static thread_local int jobs_thread_depth;
+
+static void itu_lib_jobs_execute(ITU_Job job)
+{
+	++jobs_thread_depth;
+	job.fn(job.userdata);
+	--jobs_thread_depth;
+}
+
+static int itu_lib_jobs_worker(void* userdata)
+{
+	jobs_thread_index = (int)(intptr_t)userdata;
+
+	SDL_LockMutex(jobs_ctx.mutex);
+	while(true)
+	{
+		while(!jobs_ctx.quit && jobs_ctx.jobs_next >= jobs_ctx.jobs_count)
+			SDL_WaitCondition(jobs_ctx.cond_work, jobs_ctx.mutex);
+
+		if(jobs_ctx.quit)
+			break;
+
+		ITU_Job job = jobs_ctx.jobs[jobs_ctx.jobs_next++];
+		SDL_UnlockMutex(jobs_ctx.mutex);
+
+		itu_lib_jobs_execute(job);
+
+		SDL_LockMutex(jobs_ctx.mutex);
+		if(--jobs_ctx.jobs_remaining == 0)
+			SDL_SignalCondition(jobs_ctx.cond_done);
+	}
+	SDL_UnlockMutex(jobs_ctx.mutex);
+
+	return 0;
+}
+
+// `workers_count <= 0` picks one worker per core, minus the calling thread
+void itu_lib_jobs_init(int workers_count)
+{
+	if(jobs_ctx.mutex)
+		return;
+
+	if(workers_count <= 0)
+		workers_count = SDL_GetCPUCount() - 1;
+	workers_count = SDL_clamp(workers_count, 0, ITU_JOBS_WORKERS_MAX);
+
+	jobs_ctx.mutex = SDL_CreateMutex();
+	jobs_ctx.cond_work = SDL_CreateCondition();
+	jobs_ctx.cond_done = SDL_CreateCondition();
+	jobs_thread_index = 0;
+
+	for(int i = 0; i < workers_count; ++i)
+	{
+		char name[16];
+		SDL_snprintf(name, 16, "itu_worker_%d", i + 1);
+		jobs_ctx.workers[i] = SDL_CreateThread(itu_lib_jobs_worker, name, (void*)(intptr_t)(i + 1));
+		if(!jobs_ctx.workers[i])
+		{
+			SDL_Log("WARNING unable to create worker thread: %s\n", SDL_GetError());
+			break;
+		}
+		jobs_ctx.workers_count++;
+	}
+}
+
+void itu_lib_jobs_shutdown()
+{
+	if(!jobs_ctx.mutex)
+		return;
+
+	SDL_LockMutex(jobs_ctx.mutex);
+	jobs_ctx.quit = true;
+	SDL_BroadcastCondition(jobs_ctx.cond_work);
+	SDL_UnlockMutex(jobs_ctx.mutex);
+
+	for(int i = 0; i < jobs_ctx.workers_count; ++i)
+		SDL_WaitThread(jobs_ctx.workers[i], NULL);
+
+	SDL_DestroyCondition(jobs_ctx.cond_done);
+	SDL_DestroyCondition(jobs_ctx.cond_work);
+	SDL_DestroyMutex(jobs_ctx.mutex);
+	SDL_zero(jobs_ctx);
+}
+
+void itu_lib_jobs_run(ITU_Job* jobs, int jobs_count)
+{
+	bool run_serial = jobs_count <= 1 || jobs_ctx.workers_count == 0;
+
+	if(!run_serial)
+	{
+		SDL_LockMutex(jobs_ctx.mutex);
+		// nested batch, we are already inside a job
+		run_serial = jobs_ctx.running;
+		if(!run_serial)
+		{
+			jobs_ctx.running = true;
+			jobs_ctx.jobs = jobs;
+			jobs_ctx.jobs_count = jobs_count;
+			jobs_ctx.jobs_next = 0;
+			jobs_ctx.jobs_remaining = jobs_count;
+			SDL_BroadcastCondition(jobs_ctx.cond_work);
+		}
+		else
+			SDL_UnlockMutex(jobs_ctx.mutex);
+	}
+
+	if(run_serial)
+	{
+		for(int i = 0; i < jobs_count; ++i)
+			itu_lib_jobs_execute(jobs[i]);
+		return;
+	}
+
+	// help out, instead of just waiting
+	while(jobs_ctx.jobs_next < jobs_ctx.jobs_count)
+	{
+		ITU_Job job = jobs_ctx.jobs[jobs_ctx.jobs_next++];
+		SDL_UnlockMutex(jobs_ctx.mutex);
+
+		itu_lib_jobs_execute(job);
+
+		SDL_LockMutex(jobs_ctx.mutex);
+		--jobs_ctx.jobs_remaining;
+	}
+
+	while(jobs_ctx.jobs_remaining > 0)
+		SDL_WaitCondition(jobs_ctx.cond_done, jobs_ctx.mutex);
+
+	// makes workers go back to sleep
+	jobs_ctx.jobs = NULL;
+	jobs_ctx.jobs_count = 0;
+	jobs_ctx.jobs_next = 0;
+	jobs_ctx.running = false;
+	SDL_UnlockMutex(jobs_ctx.mutex);
+}
+
+int itu_lib_jobs_get_thread_index()
+{
+	return jobs_thread_index;
+}
+
+// number of threads that can end up running jobs (workers + the calling thread)
+int itu_lib_jobs_get_threads_count()
+{
+	return jobs_ctx.workers_count + 1;
+}
+
+bool itu_lib_jobs_is_inside_job()
+{
+	return jobs_thread_depth > 0;
+}
+
+#endif // (defined ITU_LIB_JOBS_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
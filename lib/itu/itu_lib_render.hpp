@@ -3,7 +3,15 @@
 // limitations
 // - no rotation
 // - only polygons have color fill
-// 
+//
+// the `itu_lib_render_draw_*` functions render immediately (one state change + draw call each),
+// while the `itu_lib_render_debug_*` functions (and the `itu_lib_render_draw_world_*` ones, which use them)
+// only append lines and triangles to a frame buffer, which is sent to the GPU all at once
+// with a single SDL_RenderGeometry call by `itu_lib_render_debug_flush`.
+// Call it once per frame, after everything else that should be under the debug shapes.
+// The only exception is `itu_lib_render_draw_world_grid`, which draws immediately: it's a background,
+// meant to end up under everything rendered after it
+//
 // TODO
 // - get rid of VLAs
 // - get rid of BUFFER_SIZE
@@ -18,6 +26,8 @@
 #endif
 
 #define MAX_CIRCLE_VERTICES 16
+#define MAX_POLYGON_POINTS 128
+#define DEBUG_DRAW_LINE_WIDTH 1.0f
 
 void itu_lib_render_draw_point(SDL_Renderer* renderer, vec2f pos, float half_size, color color);
 void itu_lib_render_draw_line(SDL_Renderer* renderer, vec2f p0, vec2f p1, color color);
@@ -35,6 +45,15 @@ void itu_lib_render_draw_world_polygon(SDLContext* context, vec2f position, cons
 
 void itu_lib_render_draw_world_grid(SDLContext* context);
 
+const vec2f* itu_lib_render_get_unit_circle(int vertex_count);
+
+void itu_lib_render_debug_line(vec2f p0, vec2f p1, color color);
+void itu_lib_render_debug_triangle(vec2f p0, vec2f p1, vec2f p2, color color);
+void itu_lib_render_debug_circle(vec2f center, float radius, int vertex_count, color color);
+void itu_lib_render_debug_polygon(const vec2f* points, int points_count, color color_fill, color color_outline);
+void itu_lib_render_debug_flush(SDL_Renderer* renderer);
+int  itu_lib_render_debug_get_draw_calls_count();
+
 #endif // ITU_LIB_RENDER_HPP
 
 #if defined ITU_LIB_RENDER_IMPLEMENTATION || defined ITU_UNITY_BUILD
@@ -77,25 +96,18 @@ void itu_lib_render_draw_rect_fill(SDL_Renderer* renderer, vec2f min, vec2f exte
 	SDL_RenderFillRect(renderer, &rect);
 }
 
-// NOTE: vertex count must be smaller than `MAX_CIRCLE_VERTICES` (defaults to 16, but you can change it if you need to)
+// NOTE: vertex count must be at most `MAX_CIRCLE_VERTICES` (defaults to 16, but you can change it if you need to)
 void itu_lib_render_draw_circle(SDL_Renderer* renderer, vec2f center, float radius, int vertex_count, color color)
 {
 	SDL_assert(vertex_count <= MAX_CIRCLE_VERTICES);
 
 	SDL_FPoint points[MAX_CIRCLE_VERTICES + 1];
-	
-	float angle_increment = TAU / vertex_count;
+	const vec2f* unit_circle = itu_lib_render_get_unit_circle(vertex_count);
 
-	// very slow, a lot of trig
-	// we could also do a single quadrant and mirror the rest
 	for(int i = 0; i < vertex_count; ++i)
 	{
-		float angle = angle_increment * i;
-		float px = radius * SDL_cos(angle);
-		float py = radius * SDL_sin(angle);
-		// 1st quadrant
-		points[i].x = center.x + px;
-		points[i].y = center.y + py;
+		points[i].x = center.x + radius * unit_circle[i].x;
+		points[i].y = center.y + radius * unit_circle[i].y;
 	}
 	points[vertex_count] = points[0];
 	
@@ -145,26 +157,60 @@ void itu_lib_render_draw_polygon(SDL_Renderer* renderer, vec2f position, const v
 
 void itu_lib_render_draw_world_point(SDLContext* context, vec2f pos, float half_size, color color)
 {
-	itu_lib_render_draw_point(context->renderer, point_global_to_screen(context, pos), half_size, color);
+	vec2f pos_screen = point_global_to_screen(context, pos);
+	itu_lib_render_debug_line(vec2f { pos_screen.x - half_size, pos_screen.y }, vec2f { pos_screen.x + half_size, pos_screen.y }, color);
+	itu_lib_render_debug_line(vec2f { pos_screen.x, pos_screen.y - half_size }, vec2f { pos_screen.x, pos_screen.y + half_size }, color);
 }
 
 void itu_lib_render_draw_world_line(SDLContext* context, vec2f p0, vec2f p1, color color)
 {
-	itu_lib_render_draw_line(context->renderer, point_global_to_screen(context, p0), point_global_to_screen(context, p1), color);
+	itu_lib_render_debug_line(point_global_to_screen(context, p0), point_global_to_screen(context, p1), color);
+}
+
+void itu_lib_render_draw_world_rect(SDLContext* context, vec2f min, vec2f max, color color)
+{
+	vec2f points[4];
+	points[0] = point_global_to_screen(context, min);
+	points[1] = point_global_to_screen(context, vec2f { max.x, min.y });
+	points[2] = point_global_to_screen(context, max);
+	points[3] = point_global_to_screen(context, vec2f { min.x, max.y });
+
+	for(int i = 0; i < 4; ++i)
+		itu_lib_render_debug_line(points[i], points[(i + 1) % 4], color);
+}
+
+void itu_lib_render_draw_world_rect_fill(SDLContext* context, vec2f min, vec2f max, color color)
+{
+	vec2f p0 = point_global_to_screen(context, min);
+	vec2f p1 = point_global_to_screen(context, vec2f { max.x, min.y });
+	vec2f p2 = point_global_to_screen(context, max);
+	vec2f p3 = point_global_to_screen(context, vec2f { min.x, max.y });
+
+	itu_lib_render_debug_triangle(p0, p1, p2, color);
+	itu_lib_render_debug_triangle(p0, p2, p3, color);
 }
 
-void itu_lib_render_draw_world_rect(SDLContext* context, vec2f min, vec2f max, color color);
-void itu_lib_render_draw_world_rect_fill(SDLContext* context, vec2f min, vec2f max, color color);
 void itu_lib_render_draw_world_circle(SDLContext* context, vec2f center, float radius, int vertex_count, color c)
 {
-	itu_lib_render_draw_circle(context->renderer, point_global_to_screen(context, center), size_global_to_screen(context, radius), vertex_count, c);
+	itu_lib_render_debug_circle(point_global_to_screen(context, center), size_global_to_screen(context, radius), vertex_count, c);
 }
 
+// NOTE: vertex count must be at most `MAX_POLYGON_POINTS`
 void itu_lib_render_draw_world_polygon(SDLContext* context, vec2f position, const vec2f* vertices, int vertexCount, color color)
 {
-	itu_lib_render_draw_polygon(context->renderer, point_global_to_screen(context, position), vertices, vertexCount, color);
+	SDL_assert(vertexCount <= MAX_POLYGON_POINTS);
+
+	vec2f points[MAX_POLYGON_POINTS];
+	for(int i = 0; i < vertexCount; ++i)
+		points[i] = point_global_to_screen(context, position + vertices[i]);
+
+	struct color color_outline = color;
+	color_outline.a = 1.0f;
+	itu_lib_render_debug_polygon(points, vertexCount, color, color_outline);
 }
 
+// NOTE: unlike the other world helpers, this draws immediately (one SDL_RenderLine per line), so that it stays
+//       under whatever is rendered after it. Call it before entities are rendered
 void itu_lib_render_draw_world_grid(SDLContext* context)
 {
 	// const float spacing_min = 32;
@@ -217,4 +263,140 @@ void itu_lib_render_draw_world_grid(SDLContext* context)
 	for(float i = min_y + offset.y; i <= camera_window_max.y; i += spacing)
 		SDL_RenderLine(context->renderer, camera_window_min.x, i, camera_window_max.x, i);
 }
+
+// debug draw buffer
+
+struct ITU_DebugDraw
+{
+	// NOTE: stbds arrays, reset on every flush but never freed, so after the first few frames we stop allocating
+	SDL_Vertex* vertices;
+	int* indices;
+	int draw_calls_count;
+
+	// unit circles for every vertex count up to MAX_CIRCLE_VERTICES, computed the first time they are asked for
+	vec2f unit_circles[MAX_CIRCLE_VERTICES + 1][MAX_CIRCLE_VERTICES];
+	Uint32 unit_circles_ready_mask;
+};
+static_assert(MAX_CIRCLE_VERTICES < 32, "unit_circles_ready_mask has one bit per vertex count");
+
+ITU_DebugDraw debug_draw_data;
+
+const vec2f* itu_lib_render_get_unit_circle(int vertex_count)
+{
+	SDL_assert(vertex_count > 0 && vertex_count <= MAX_CIRCLE_VERTICES);
+
+	vec2f* ret = debug_draw_data.unit_circles[vertex_count];
+	if(!(debug_draw_data.unit_circles_ready_mask & (1 << vertex_count)))
+	{
+		float angle_increment = TAU / vertex_count;
+		for(int i = 0; i < vertex_count; ++i)
+		{
+			float angle = angle_increment * i;
+			ret[i].x = SDL_cosf(angle);
+			ret[i].y = SDL_sinf(angle);
+		}
+		debug_draw_data.unit_circles_ready_mask |= (1 << vertex_count);
+	}
+	return ret;
+}
+
+// returns the index of the first added vertex
+static int itu_lib_render_debug_add_vertices(const vec2f* points, int points_count, color color)
+{
+	SDL_FColor color_vertex = { color.r, color.g, color.b, color.a };
+
+	int ret = (int)stbds_arrlen(debug_draw_data.vertices);
+	SDL_Vertex* vs = stbds_arraddnptr(debug_draw_data.vertices, points_count);
+	for(int i = 0; i < points_count; ++i)
+	{
+		vs[i].position.x = points[i].x;
+		vs[i].position.y = points[i].y;
+		vs[i].color = color_vertex;
+		vs[i].tex_coord.x = 0;
+		vs[i].tex_coord.y = 0;
+	}
+	return ret;
+}
+
+// NOTE: SDL_RenderGeometry only knows about triangles, so lines become thin quads
+//       (DEBUG_DRAW_LINE_WIDTH pixels wide, extruded along the line normal)
+void itu_lib_render_debug_line(vec2f p0, vec2f p1, color color)
+{
+	vec2f dir = p1 - p0;
+	float len = SDL_sqrtf(dir.x * dir.x + dir.y * dir.y);
+	if(len == 0)
+		return;
+
+	vec2f n = vec2f { -dir.y, dir.x } * (DEBUG_DRAW_LINE_WIDTH * 0.5f / len);
+	vec2f points[4] = { p0 + n, p1 + n, p1 - n, p0 - n };
+
+	int base = itu_lib_render_debug_add_vertices(points, 4, color);
+	int* is = stbds_arraddnptr(debug_draw_data.indices, 6);
+	is[0] = base + 0; is[1] = base + 1; is[2] = base + 2;
+	is[3] = base + 0; is[4] = base + 2; is[5] = base + 3;
+}
+
+void itu_lib_render_debug_triangle(vec2f p0, vec2f p1, vec2f p2, color color)
+{
+	vec2f points[3] = { p0, p1, p2 };
+
+	int base = itu_lib_render_debug_add_vertices(points, 3, color);
+	int* is = stbds_arraddnptr(debug_draw_data.indices, 3);
+	is[0] = base + 0; is[1] = base + 1; is[2] = base + 2;
+}
+
+// NOTE: vertex count must be at most `MAX_CIRCLE_VERTICES`
+void itu_lib_render_debug_circle(vec2f center, float radius, int vertex_count, color color)
+{
+	const vec2f* unit_circle = itu_lib_render_get_unit_circle(vertex_count);
+
+	vec2f p_prev = center + vec2f { unit_circle[vertex_count - 1].x * radius, unit_circle[vertex_count - 1].y * radius };
+	for(int i = 0; i < vertex_count; ++i)
+	{
+		vec2f p = center + vec2f { unit_circle[i].x * radius, unit_circle[i].y * radius };
+		itu_lib_render_debug_line(p_prev, p, color);
+		p_prev = p;
+	}
+}
+
+// convex polygon, filled as a triangle fan and then outlined
+void itu_lib_render_debug_polygon(const vec2f* points, int points_count, color color_fill, color color_outline)
+{
+	if(points_count < 3)
+		return;
+
+	int base = itu_lib_render_debug_add_vertices(points, points_count, color_fill);
+	int* is = stbds_arraddnptr(debug_draw_data.indices, (points_count - 2) * 3);
+	for(int i = 2; i < points_count; ++i)
+	{
+		*is++ = base;
+		*is++ = base + i - 1;
+		*is++ = base + i;
+	}
+
+	for(int i = 0; i < points_count; ++i)
+		itu_lib_render_debug_line(points[i], points[(i + 1) % points_count], color_outline);
+}
+
+void itu_lib_render_debug_flush(SDL_Renderer* renderer)
+{
+	debug_draw_data.draw_calls_count = 0;
+	if(stbds_arrlen(debug_draw_data.indices) == 0)
+		return;
+
+	SDL_RenderGeometry(
+		renderer, NULL,
+		debug_draw_data.vertices, (int)stbds_arrlen(debug_draw_data.vertices),
+		debug_draw_data.indices,  (int)stbds_arrlen(debug_draw_data.indices)
+	);
+	debug_draw_data.draw_calls_count = 1;
+
+	stbds_arrsetlen(debug_draw_data.vertices, 0);
+	stbds_arrsetlen(debug_draw_data.indices, 0);
+}
+
+int itu_lib_render_debug_get_draw_calls_count()
+{
+	return debug_draw_data.draw_calls_count;
+}
 # endif //ITU_LIB_RENDER_IMPLEMENTATION
@@ -5,6 +5,18 @@
 #include <itu_lib_engine.hpp>
 #endif
 
+// blend mode used to draw a sprite. DEFAULT leaves whatever is set on the texture
+enum ITU_SpriteBlend
+{
+	ITU_SPRITE_BLEND_DEFAULT,
+	ITU_SPRITE_BLEND_NONE,
+	ITU_SPRITE_BLEND_ALPHA,
+	ITU_SPRITE_BLEND_ADD,
+	ITU_SPRITE_BLEND_MOD,
+	ITU_SPRITE_BLEND_MUL,
+	ITU_SPRITE_BLEND_MAX
+};
+
 struct Sprite
 {
 	SDL_Texture* texture;
@@ -12,6 +24,12 @@ struct Sprite
 	vec2f        pivot;
 	color        tint;
 	bool         flip_horizontal;
+
+	// render order, only used by batches (see `itu_lib_sprite_batch_add()`).
+	// Higher layers are drawn on top, within the same layer higher depths are drawn first (ie, set it to the y position for top-down games)
+	Uint8        layer;
+	Uint8        blend; // ITU_SpriteBlend
+	float        depth;
 };
 
 void itu_lib_sprite_init(Sprite* sprite, SDL_Texture* texture, SDL_FRect rect);
@@ -21,6 +39,15 @@ vec2f itu_lib_sprite_get_world_size(SDLContext* context, Sprite* sprite, Transfo
 void itu_lib_sprite_render(SDLContext* context, Sprite* sprite, Transform* transform);
 void itu_lib_sprite_render_debug(SDLContext* context, Sprite* sprite, Transform* transform);
 
+// sprite batching: quads are computed on the CPU (pivot, rotation and flip included) and queued with a 64-bit sort key
+// (layer, depth, texture, blend mode). On flush they are sorted, and every run of quads sharing texture and blend mode
+// is submitted with a single `SDL_RenderGeometry()` call.
+// NOTE: sprites with the same key are drawn in the order they were added
+// NOTE: vertices are in screen space for the active camera, flush before switching camera
+void itu_lib_sprite_batch_add(SDLContext* context, Sprite* sprite, Transform* transform);
+void itu_lib_sprite_batch_flush(SDLContext* context);
+int  itu_lib_sprite_batch_get_draw_calls_count();
+
 #endif // ITU_LIB_SPRITE_HPP
 
 #if (defined ITU_LIB_SPRITE_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
@@ -28,6 +55,9 @@ void itu_lib_sprite_render_debug(SDLContext* context, Sprite* sprite, Transform*
 #include <SDL3/SDL.h>
 
 
+// maps ITU_SpriteBlend to SDL blend modes (DEFAULT is never used, it means "don't touch the texture")
+const SDL_BlendMode sprite_blend_modes[ITU_SPRITE_BLEND_MAX] = { 0, SDL_BLENDMODE_NONE, SDL_BLENDMODE_BLEND, SDL_BLENDMODE_ADD, SDL_BLENDMODE_MOD, SDL_BLENDMODE_MUL };
+
 // inits sprite with reasonable defaults
 void itu_lib_sprite_init(Sprite* sprite, SDL_Texture* texture, SDL_FRect rect)
 {
@@ -35,6 +65,10 @@ void itu_lib_sprite_init(Sprite* sprite, SDL_Texture* texture, SDL_FRect rect)
 	sprite->rect = rect;
 	sprite->pivot = vec2f{ 0.5f, 0.5f };
 	sprite->tint = COLOR_WHITE;
+	sprite->flip_horizontal = false;
+	sprite->layer = 0;
+	sprite->blend = ITU_SPRITE_BLEND_DEFAULT;
+	sprite->depth = 0;
 }
 
 SDL_FRect itu_lib_sprite_get_rect(int x, int y, int tile_w, int tile_h)
@@ -79,6 +113,13 @@ void itu_lib_sprite_render(SDLContext* context, Sprite* sprite, Transform* trans
 	pivot_dst.x = sprite->pivot.x * rect_dst.w;
 	pivot_dst.y = sprite->pivot.y * rect_dst.h;
 
+	SDL_BlendMode blend_mode_prev;
+	if(sprite->blend != ITU_SPRITE_BLEND_DEFAULT)
+	{
+		SDL_GetTextureBlendMode(sprite->texture, &blend_mode_prev);
+		SDL_SetTextureBlendMode(sprite->texture, sprite_blend_modes[sprite->blend]);
+	}
+
 	sdl_set_texture_tint(sprite->texture, sprite->tint);
 	SDL_RenderTextureRotated(
 		context->renderer,
@@ -89,6 +130,262 @@ void itu_lib_sprite_render(SDLContext* context, Sprite* sprite, Transform* trans
 		&pivot_dst,
 		sprite->flip_horizontal ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE
 	);
+
+	if(sprite->blend != ITU_SPRITE_BLEND_DEFAULT)
+		SDL_SetTextureBlendMode(sprite->texture, blend_mode_prev);
+}
+
+#define SPRITE_TEXTURE_IDS_MAX 0xffff
+
+struct ITU_SpriteBatchQuad
+{
+	SDL_Vertex vertices[4]; // top-left, top-right, bottom-right, bottom-left (before rotation)
+	int texture_slot;       // location in `ITU_SpriteBatch::textures`
+	Uint8 blend;
+};
+
+// what gets sorted, small so that moving it around is cheap
+struct ITU_SpriteBatchPacket
+{
+	Uint64 key;
+	int quad;
+};
+
+struct ITU_SpriteBatch
+{
+	stbds_arr(ITU_SpriteBatchQuad)   quads;
+	stbds_arr(ITU_SpriteBatchPacket) packets;
+	stbds_arr(ITU_SpriteBatchPacket) packets_tmp;
+
+	stbds_arr(SDL_Texture*)  textures;      // textures used by `quads`, in order of first use
+	stbds_arr(vec2f)         textures_size_inv;
+	stbds_arr(SDL_BlendMode) textures_blend_mode; // before the flush, restored after it
+
+	// ids used in sort keys. Unlike slots, they never change, so that equal sprites don't swap places from one frame to the next
+	stbds_hm(SDL_Texture*, Uint16) texture_ids;
+
+	// submitted data. All buffers keep their memory between flushes
+	stbds_arr(SDL_Vertex) vertices;
+	stbds_arr(int)        indices; // the same two triangles pattern repeated, only grows
+
+	int draw_calls_count; // in the last flush
+};
+
+ITU_SpriteBatch sprite_batch_data;
+
+int itu_lib_sprite_batch_texture_slot(SDL_Texture* texture)
+{
+	// NOTE: consecutive sprites most likely share the texture, and there are only a handful of textures in a batch anyway
+	int textures_count = stbds_arrlen(sprite_batch_data.textures);
+	for(int i = textures_count - 1; i >= 0; --i)
+		if(sprite_batch_data.textures[i] == texture)
+			return i;
+
+	float w, h;
+	SDL_BlendMode blend_mode;
+	SDL_GetTextureSize(texture, &w, &h);
+	SDL_GetTextureBlendMode(texture, &blend_mode);
+	stbds_arrput(sprite_batch_data.textures, texture);
+	stbds_arrput(sprite_batch_data.textures_size_inv, (vec2f{ 1.0f / w, 1.0f / h }));
+	stbds_arrput(sprite_batch_data.textures_blend_mode, blend_mode);
+	return textures_count;
+}
+
+Uint16 itu_lib_sprite_batch_texture_id(SDL_Texture* texture)
+{
+	int idx = stbds_hmgeti(sprite_batch_data.texture_ids, texture);
+	if(idx != -1)
+		return sprite_batch_data.texture_ids[idx].value;
+
+	// NOTE: ids are never recycled, past the limit textures just share the last one (still correct, they only batch worse)
+	Uint16 ret = (Uint16)SDL_min(stbds_hmlen(sprite_batch_data.texture_ids), SPRITE_TEXTURE_IDS_MAX);
+	stbds_hmput(sprite_batch_data.texture_ids, texture, ret);
+	return ret;
+}
+
+// render order, from most to least important: layer, depth (higher first), texture, blend mode
+Uint64 itu_lib_sprite_sort_key(Sprite* sprite)
+{
+	Uint64 key_depth = (~itu_sort_key_from_float(sprite->depth)) & 0xffffffff;
+
+	Uint64 ret = 0;
+	ret |= (Uint64)sprite->layer << 56;
+	ret |= key_depth << 24;
+	ret |= (Uint64)itu_lib_sprite_batch_texture_id(sprite->texture) << 8;
+	ret |= (Uint64)sprite->blend;
+	return ret;
+}
+
+// same result as `itu_lib_sprite_render()`
+void itu_lib_sprite_batch_add(SDLContext* context, Sprite* sprite, Transform* transform)
+{
+	SDL_assert(sprite->blend < ITU_SPRITE_BLEND_MAX);
+
+	ITU_SpriteBatchPacket* packet = stbds_arraddnptr(sprite_batch_data.packets, 1);
+	packet->key = itu_lib_sprite_sort_key(sprite);
+	packet->quad = stbds_arrlen(sprite_batch_data.quads);
+
+	ITU_SpriteBatchQuad* quad = stbds_arraddnptr(sprite_batch_data.quads, 1);
+	quad->texture_slot = itu_lib_sprite_batch_texture_slot(sprite->texture);
+	quad->blend = sprite->blend;
+
+	SDL_FRect rect_dst = itu_lib_sprite_get_screen_rect(context, sprite, transform);
+
+	// NOTE: same math as `SDL_RenderTextureRotated()`, rotating clockwise (screen y goes down) around the pivot
+	float center_x = rect_dst.x + sprite->pivot.x * rect_dst.w;
+	float center_y = rect_dst.y + sprite->pivot.y * rect_dst.h;
+	float sin_r = SDL_sinf(-transform->rotation);
+	float cos_r = SDL_cosf(-transform->rotation);
+
+	float min_x = rect_dst.x - center_x;
+	float min_y = rect_dst.y - center_y;
+	float max_x = min_x + rect_dst.w;
+	float max_y = min_y + rect_dst.h;
+
+	vec2f size_inv = sprite_batch_data.textures_size_inv[quad->texture_slot];
+	float min_u = sprite->rect.x * size_inv.x;
+	float min_v = sprite->rect.y * size_inv.y;
+	float max_u = (sprite->rect.x + sprite->rect.w) * size_inv.x;
+	float max_v = (sprite->rect.y + sprite->rect.h) * size_inv.y;
+	if(sprite->flip_horizontal)
+	{
+		float tmp = min_u;
+		min_u = max_u;
+		max_u = tmp;
+	}
+
+	float corners_x[4] = { min_x, max_x, max_x, min_x };
+	float corners_y[4] = { min_y, min_y, max_y, max_y };
+	float corners_u[4] = { min_u, max_u, max_u, min_u };
+	float corners_v[4] = { min_v, min_v, max_v, max_v };
+	for(int i = 0; i < 4; ++i)
+	{
+		SDL_Vertex* vertex = &quad->vertices[i];
+		vertex->position.x = center_x + corners_x[i] * cos_r - corners_y[i] * sin_r;
+		vertex->position.y = center_y + corners_x[i] * sin_r + corners_y[i] * cos_r;
+		vertex->tex_coord.x = corners_u[i];
+		vertex->tex_coord.y = corners_v[i];
+		vertex->color.r = sprite->tint.r;
+		vertex->color.g = sprite->tint.g;
+		vertex->color.b = sprite->tint.b;
+		vertex->color.a = sprite->tint.a;
+	}
+}
+
+// LSD radix sort of the packets by key, one byte at a time. Stable, so sprites with the same key keep the order they were added in
+// NOTE: bytes that are the same for all packets (ie, the layer, when everything is on layer 0) are skipped entirely
+void itu_lib_sprite_batch_sort()
+{
+	int count = stbds_arrlen(sprite_batch_data.packets);
+	stbds_arrsetlen(sprite_batch_data.packets_tmp, count);
+
+	ITU_SpriteBatchPacket* src = sprite_batch_data.packets;
+	ITU_SpriteBatchPacket* dst = sprite_batch_data.packets_tmp;
+	for(int shift = 0; shift < 64; shift += 8)
+	{
+		int offsets[256] = { 0 };
+		for(int i = 0; i < count; ++i)
+			++offsets[(src[i].key >> shift) & 0xff];
+
+		if(offsets[(src[0].key >> shift) & 0xff] == count)
+			continue;
+
+		int total = 0;
+		for(int i = 0; i < 256; ++i)
+		{
+			int digit_count = offsets[i];
+			offsets[i] = total;
+			total += digit_count;
+		}
+
+		for(int i = 0; i < count; ++i)
+			dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+
+		ITU_SpriteBatchPacket* tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	// NOTE: stb_ds arrays carry their own length and capacity, so if the result ended up in the other one we can just swap them
+	if(src != sprite_batch_data.packets)
+	{
+		sprite_batch_data.packets_tmp = sprite_batch_data.packets;
+		sprite_batch_data.packets = src;
+	}
+}
+
+void itu_lib_sprite_batch_flush(SDLContext* context)
+{
+	int quads_count = stbds_arrlen(sprite_batch_data.quads);
+	int textures_count = stbds_arrlen(sprite_batch_data.textures);
+	sprite_batch_data.draw_calls_count = 0;
+	if(quads_count == 0)
+		return;
+
+	itu_lib_sprite_batch_sort();
+
+	stbds_arrsetlen(sprite_batch_data.vertices, quads_count * 4);
+	for(int i = 0; i < quads_count; ++i)
+	{
+		ITU_SpriteBatchQuad* quad = &sprite_batch_data.quads[sprite_batch_data.packets[i].quad];
+		SDL_memcpy(&sprite_batch_data.vertices[i * 4], quad->vertices, sizeof(quad->vertices));
+	}
+
+	int indices_count = stbds_arrlen(sprite_batch_data.indices);
+	if(indices_count < quads_count * 6)
+	{
+		stbds_arrsetlen(sprite_batch_data.indices, quads_count * 6);
+		for(int i = indices_count / 6; i < quads_count; ++i)
+		{
+			int* indices = &sprite_batch_data.indices[i * 6];
+			indices[0] = i * 4 + 0;
+			indices[1] = i * 4 + 1;
+			indices[2] = i * 4 + 2;
+			indices[3] = i * 4 + 0;
+			indices[4] = i * 4 + 2;
+			indices[5] = i * 4 + 3;
+		}
+	}
+
+	// NOTE: the tint is in the vertex colors, make sure what `itu_lib_sprite_render()` left on the textures doesn't get in the way
+	for(int i = 0; i < textures_count; ++i)
+		sdl_set_texture_tint(sprite_batch_data.textures[i], COLOR_WHITE);
+
+	// one draw call for each run of quads sharing texture and blend mode
+	int run_first = 0;
+	for(int i = 1; i <= quads_count; ++i)
+	{
+		ITU_SpriteBatchQuad* quad_first = &sprite_batch_data.quads[sprite_batch_data.packets[run_first].quad];
+		if(i < quads_count)
+		{
+			ITU_SpriteBatchQuad* quad = &sprite_batch_data.quads[sprite_batch_data.packets[i].quad];
+			if(quad->texture_slot == quad_first->texture_slot && quad->blend == quad_first->blend)
+				continue;
+		}
+
+		SDL_Texture* texture = sprite_batch_data.textures[quad_first->texture_slot];
+		SDL_BlendMode blend_mode = quad_first->blend == ITU_SPRITE_BLEND_DEFAULT ? sprite_batch_data.textures_blend_mode[quad_first->texture_slot] : sprite_blend_modes[quad_first->blend];
+		SDL_SetTextureBlendMode(texture, blend_mode);
+
+		int count = i - run_first;
+		SDL_RenderGeometry(context->renderer, texture, &sprite_batch_data.vertices[run_first * 4], count * 4, sprite_batch_data.indices, count * 6);
+		++sprite_batch_data.draw_calls_count;
+		run_first = i;
+	}
+
+	for(int i = 0; i < textures_count; ++i)
+		SDL_SetTextureBlendMode(sprite_batch_data.textures[i], sprite_batch_data.textures_blend_mode[i]);
+
+	stbds_arrsetlen(sprite_batch_data.quads, 0);
+	stbds_arrsetlen(sprite_batch_data.packets, 0);
+	stbds_arrsetlen(sprite_batch_data.textures, 0);
+	stbds_arrsetlen(sprite_batch_data.textures_size_inv, 0);
+	stbds_arrsetlen(sprite_batch_data.textures_blend_mode, 0);
+}
+
+int itu_lib_sprite_batch_get_draw_calls_count()
+{
+	return sprite_batch_data.draw_calls_count;
 }
 
 void itu_lib_sprite_render_debug(SDLContext* context, Sprite* sprite, Transform* transform)
@@ -0,0 +1,280 @@
+// tilemaps
+// - tiles are stored as indices into a tileset texture (a packed grid of same-sized tiles, like the Kenney tilesheets
+//   in `data/kenney`), in a dense grid. Tile (0, 0) is the bottom-left one, with its corner at the entity position
+// - the map is split in chunks of TILEMAP_CHUNK_SIZE x TILEMAP_CHUNK_SIZE tiles, each one baked into its own render target
+//   the first time it's needed, so that rendering a chunk is a single draw no matter how many tiles it has.
+//   Changing a tile only re-bakes its chunk
+// - only chunks under the camera (and a ring of chunks around it, a few per frame) are baked. Chunks that have not been
+//   seen for TILEMAP_CHUNK_EVICT_RENDERS renders give their texture back, so big maps only keep around what is being used
+//
+// NOTE: the tilemap owns its memory (tiles and chunk textures), released with `itu_lib_tilemap_destroy()`. As a component,
+//       this happens automatically when it's removed (see observers in `itu_sys_estorage_init()`).
+//       Like box2d bodies, tiles live outside of the entity storage, so snapshots and world files only save the pointers
+//       (restoring drops tilemaps that were destroyed in the meantime, see `itu_lib_tilemap_is_alive()`)
+// NOTE: rotation is ignored, scale just scales the tiles
+// NOTE: tilemaps are rendered by their own system before sprites, so they always end up below them
+
+#ifndef ITU_LIB_TILEMAP_HPP
+#define ITU_LIB_TILEMAP_HPP
+
+#ifndef ITU_UNITY_BUILD
+#include <itu_lib_engine.hpp>
+#endif
+
+#define TILEMAP_CHUNK_SIZE 16
+#define TILEMAP_CHUNK_EVICT_RENDERS 120
+#define TILEMAP_CHUNK_PREFETCH_PER_RENDER 2
+#define TILEMAP_TILE_EMPTY 0xffff
+
+struct ITU_TilemapChunk
+{
+	SDL_Texture* texture; // NULL until baked (or after being evicted)
+	Uint32 last_render;   // `Tilemap::renders_count` the last time this chunk was visible
+	bool   dirty;         // tiles changed since the last bake
+};
+
+struct Tilemap
+{
+	SDL_Texture* tileset;
+	int tileset_columns;
+	int tile_size_px;   // size of a tile in the tileset
+	float tile_size;    // size of a tile in the world
+
+	int width;
+	int height;
+	Uint16* tiles;      // `width * height` indices into the tileset (row by row, starting from the bottom), or TILEMAP_TILE_EMPTY
+
+	int chunks_w;
+	int chunks_h;
+	ITU_TilemapChunk* chunks;
+
+	// stats
+	Uint32 renders_count;
+	int chunks_resident_count; // chunks with a texture
+	int bakes_count;           // in the last render
+};
+
+void   itu_lib_tilemap_init(Tilemap* tilemap, SDL_Texture* tileset, int tile_size_px, int width, int height);
+void   itu_lib_tilemap_destroy(Tilemap* tilemap);
+bool   itu_lib_tilemap_is_alive(Tilemap* tilemap);
+void   itu_lib_tilemap_set(Tilemap* tilemap, int x, int y, Uint16 tile);
+Uint16 itu_lib_tilemap_get(Tilemap* tilemap, int x, int y);
+void   itu_lib_tilemap_render(SDLContext* context, Tilemap* tilemap, Transform* transform);
+
+#endif // ITU_LIB_TILEMAP_HPP
+
+#if (defined ITU_LIB_TILEMAP_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
+
+// tiles of every tilemap between init and destroy, mapped to its chunks (see `itu_lib_tilemap_is_alive()`)
+stbds_hm(Uint16*, ITU_TilemapChunk*) tilemap_alive_lookup;
+
+// all tiles start empty. The world size of tiles follows the same convention as sprites (TEXTURE_PIXELS_PER_UNIT)
+void itu_lib_tilemap_init(Tilemap* tilemap, SDL_Texture* tileset, int tile_size_px, int width, int height)
+{
+	SDL_assert(width > 0 && height > 0);
+	SDL_zerop(tilemap);
+
+	float tileset_w, tileset_h;
+	SDL_GetTextureSize(tileset, &tileset_w, &tileset_h);
+
+	tilemap->tileset = tileset;
+	tilemap->tileset_columns = (int)tileset_w / tile_size_px;
+	tilemap->tile_size_px = tile_size_px;
+	tilemap->tile_size = (float)tile_size_px / TEXTURE_PIXELS_PER_UNIT;
+
+	tilemap->width = width;
+	tilemap->height = height;
+	tilemap->tiles = (Uint16*)SDL_malloc(sizeof(Uint16) * width * height);
+	SDL_memset(tilemap->tiles, 0xff, sizeof(Uint16) * width * height);
+
+	tilemap->chunks_w = (width  + TILEMAP_CHUNK_SIZE - 1) / TILEMAP_CHUNK_SIZE;
+	tilemap->chunks_h = (height + TILEMAP_CHUNK_SIZE - 1) / TILEMAP_CHUNK_SIZE;
+	tilemap->chunks = (ITU_TilemapChunk*)SDL_calloc(tilemap->chunks_w * tilemap->chunks_h, sizeof(ITU_TilemapChunk));
+
+	stbds_hmput(tilemap_alive_lookup, tilemap->tiles, tilemap->chunks);
+}
+
+void itu_lib_tilemap_destroy(Tilemap* tilemap)
+{
+	if(tilemap->chunks)
+	{
+		for(int i = 0; i < tilemap->chunks_w * tilemap->chunks_h; ++i)
+			if(tilemap->chunks[i].texture)
+				SDL_DestroyTexture(tilemap->chunks[i].texture);
+	}
+	if(tilemap->tiles)
+		stbds_hmdel(tilemap_alive_lookup, tilemap->tiles);
+	SDL_free(tilemap->chunks);
+	SDL_free(tilemap->tiles);
+	SDL_zerop(tilemap);
+}
+
+// false if the memory `tilemap` points to was released (ie, a copy restored from a snapshot taken before the tilemap was destroyed).
+// A zeroed tilemap doesn't own anything, and counts as alive
+bool itu_lib_tilemap_is_alive(Tilemap* tilemap)
+{
+	if(!tilemap->tiles)
+		return true;
+
+	int idx = stbds_hmgeti(tilemap_alive_lookup, tilemap->tiles);
+	return idx >= 0 && tilemap_alive_lookup[idx].value == tilemap->chunks;
+}
+
+void itu_lib_tilemap_set(Tilemap* tilemap, int x, int y, Uint16 tile)
+{
+	SDL_assert(x >= 0 && x < tilemap->width && y >= 0 && y < tilemap->height);
+
+	Uint16* dst = &tilemap->tiles[y * tilemap->width + x];
+	if(*dst == tile)
+		return;
+
+	*dst = tile;
+	tilemap->chunks[(y / TILEMAP_CHUNK_SIZE) * tilemap->chunks_w + x / TILEMAP_CHUNK_SIZE].dirty = true;
+}
+
+Uint16 itu_lib_tilemap_get(Tilemap* tilemap, int x, int y)
+{
+	if(x < 0 || x >= tilemap->width || y < 0 || y >= tilemap->height)
+		return TILEMAP_TILE_EMPTY;
+	return tilemap->tiles[y * tilemap->width + x];
+}
+
+// draws all the tiles of a chunk into its texture (creating it if needed)
+// NOTE: in SDL3 viewport and scale belong to the render target, so switching target back restores the camera ones too
+void itu_lib_tilemap_chunk_bake(SDLContext* context, Tilemap* tilemap, int chunk_x, int chunk_y)
+{
+	ITU_TilemapChunk* chunk = &tilemap->chunks[chunk_y * tilemap->chunks_w + chunk_x];
+	int chunk_size_px = TILEMAP_CHUNK_SIZE * tilemap->tile_size_px;
+
+	if(!chunk->texture)
+	{
+		chunk->texture = SDL_CreateTexture(context->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, chunk_size_px, chunk_size_px);
+		VALIDATE_PANIC(chunk->texture);
+		SDL_SetTextureScaleMode(chunk->texture, SDL_SCALEMODE_NEAREST);
+		SDL_SetTextureBlendMode(chunk->texture, SDL_BLENDMODE_BLEND);
+		++tilemap->chunks_resident_count;
+	}
+
+	SDL_Texture* target_prev = SDL_GetRenderTarget(context->renderer);
+	float r, g, b, a;
+	SDL_GetRenderDrawColorFloat(context->renderer, &r, &g, &b, &a);
+
+	SDL_SetRenderTarget(context->renderer, chunk->texture);
+	SDL_SetRenderDrawColorFloat(context->renderer, 0, 0, 0, 0);
+	SDL_RenderClear(context->renderer);
+
+	sdl_set_texture_tint(tilemap->tileset, COLOR_WHITE);
+
+	int tile_x_first = chunk_x * TILEMAP_CHUNK_SIZE;
+	int tile_y_first = chunk_y * TILEMAP_CHUNK_SIZE;
+	int tile_x_end = SDL_min(tile_x_first + TILEMAP_CHUNK_SIZE, tilemap->width);
+	int tile_y_end = SDL_min(tile_y_first + TILEMAP_CHUNK_SIZE, tilemap->height);
+	for(int y = tile_y_first; y < tile_y_end; ++y)
+	{
+		for(int x = tile_x_first; x < tile_x_end; ++x)
+		{
+			Uint16 tile = tilemap->tiles[y * tilemap->width + x];
+			if(tile == TILEMAP_TILE_EMPTY)
+				continue;
+
+			SDL_FRect rect_src;
+			rect_src.x = (float)((tile % tilemap->tileset_columns) * tilemap->tile_size_px);
+			rect_src.y = (float)((tile / tilemap->tileset_columns) * tilemap->tile_size_px);
+			rect_src.w = (float)tilemap->tile_size_px;
+			rect_src.h = (float)tilemap->tile_size_px;
+
+			// NOTE: texture rows go down, tilemap rows go up
+			SDL_FRect rect_dst;
+			rect_dst.x = (float)((x - tile_x_first) * tilemap->tile_size_px);
+			rect_dst.y = (float)((TILEMAP_CHUNK_SIZE - 1 - (y - tile_y_first)) * tilemap->tile_size_px);
+			rect_dst.w = (float)tilemap->tile_size_px;
+			rect_dst.h = (float)tilemap->tile_size_px;
+
+			SDL_RenderTexture(context->renderer, tilemap->tileset, &rect_src, &rect_dst);
+		}
+	}
+
+	SDL_SetRenderTarget(context->renderer, target_prev);
+	SDL_SetRenderDrawColorFloat(context->renderer, r, g, b, a);
+
+	chunk->dirty = false;
+	++tilemap->bakes_count;
+}
+
+// renders the chunks under the active camera, baking the ones that need it
+void itu_lib_tilemap_render(SDLContext* context, Tilemap* tilemap, Transform* transform)
+{
+	++tilemap->renders_count;
+	tilemap->bakes_count = 0;
+
+	vec2f origin = transform->position;
+	vec2f chunk_size;
+	chunk_size.x = TILEMAP_CHUNK_SIZE * tilemap->tile_size * transform->scale.x;
+	chunk_size.y = TILEMAP_CHUNK_SIZE * tilemap->tile_size * transform->scale.y;
+
+	// chunks range under the camera (plus a ring around it, to bake ahead of time)
+	SDL_FRect camera_rect = camera_get_world_rect(context, context->camera_active);
+	int visible_x_min = (int)SDL_floorf((camera_rect.x                 - origin.x) / chunk_size.x);
+	int visible_y_min = (int)SDL_floorf((camera_rect.y                 - origin.y) / chunk_size.y);
+	int visible_x_max = (int)SDL_floorf((camera_rect.x + camera_rect.w - origin.x) / chunk_size.x);
+	int visible_y_max = (int)SDL_floorf((camera_rect.y + camera_rect.h - origin.y) / chunk_size.y);
+
+	int prefetch_budget = TILEMAP_CHUNK_PREFETCH_PER_RENDER;
+	int x_min = SDL_max(visible_x_min - 1, 0);
+	int y_min = SDL_max(visible_y_min - 1, 0);
+	int x_max = SDL_min(visible_x_max + 1, tilemap->chunks_w - 1);
+	int y_max = SDL_min(visible_y_max + 1, tilemap->chunks_h - 1);
+	for(int y = y_min; y <= y_max; ++y)
+	{
+		for(int x = x_min; x <= x_max; ++x)
+		{
+			ITU_TilemapChunk* chunk = &tilemap->chunks[y * tilemap->chunks_w + x];
+			bool is_visible = x >= visible_x_min && x <= visible_x_max && y >= visible_y_min && y <= visible_y_max;
+			bool needs_bake = !chunk->texture || chunk->dirty;
+
+			if(!is_visible)
+			{
+				// NOTE: the ring counts as used, so chunks right outside the camera are not evicted while going back and forth
+				if(chunk->texture)
+					chunk->last_render = tilemap->renders_count;
+				else if(prefetch_budget > 0)
+				{
+					--prefetch_budget;
+					itu_lib_tilemap_chunk_bake(context, tilemap, x, y);
+					chunk->last_render = tilemap->renders_count;
+				}
+				continue;
+			}
+
+			chunk->last_render = tilemap->renders_count;
+			if(needs_bake)
+				itu_lib_tilemap_chunk_bake(context, tilemap, x, y);
+
+			SDL_FRect rect;
+			rect.x = origin.x + x * chunk_size.x;
+			rect.y = origin.y + y * chunk_size.y;
+			rect.w = chunk_size.x;
+			rect.h = chunk_size.y;
+			rect = rect_global_to_screen(context, rect);
+			SDL_RenderTexture(context->renderer, chunk->texture, NULL, &rect);
+		}
+	}
+
+	// give back the textures of chunks that have not been around the camera for a while
+	if(tilemap->renders_count > TILEMAP_CHUNK_EVICT_RENDERS)
+	{
+		Uint32 evict_before = tilemap->renders_count - TILEMAP_CHUNK_EVICT_RENDERS;
+		for(int i = 0; i < tilemap->chunks_w * tilemap->chunks_h; ++i)
+		{
+			ITU_TilemapChunk* chunk = &tilemap->chunks[i];
+			if(chunk->texture && chunk->last_render < evict_before)
+			{
+				SDL_DestroyTexture(chunk->texture);
+				chunk->texture = NULL;
+				--tilemap->chunks_resident_count;
+			}
+		}
+	}
+}
+
+#endif // (defined ITU_LIB_TILEMAP_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
@@ -6,6 +6,7 @@
 
 #ifndef ITU_UNITY_BUILD
 #include <itu_lib_engine.hpp>
+#include <itu_lib_render.hpp>
 #endif
 
 
@@ -40,6 +41,7 @@ void itu_sys_physics_init(SDLContext* context);
 void itu_sys_physics_reset(const b2WorldDef* world_def);
 void itu_sys_physics_step(float fixed_delta);
 b2BodyId itu_sys_physics_add_body(void* entity, b2BodyDef* body_def);
+void itu_sys_physics_remove_body(b2BodyId body_id);
 void* itu_sys_physics_get_entity(b2BodyId body_id);
 b2SensorEvents ity_sys_physics_get_sensor_events();
 void itu_sys_physics_debug_draw();
@@ -100,6 +102,15 @@ b2BodyId itu_sys_physics_add_body(void* entity, b2BodyDef* body_def)
 	return ret;
 }
 
+// NOTE: safe to call on bodies already gone (ie, with the world that was reset), it only forgets about them
+void itu_sys_physics_remove_body(b2BodyId body_id)
+{
+	stbds_hmdel(sys_physics_data.map_b2body_entity, body_id);
+
+	if(b2World_IsValid(sys_physics_data.world_id) && b2Body_IsValid(body_id))
+		b2DestroyBody(body_id);
+}
+
 void* itu_sys_physics_get_entity(b2BodyId body_id)
 {
 	return stbds_hmget(sys_physics_data.map_b2body_entity, body_id);
@@ -119,64 +130,39 @@ void itu_sys_physics_debug_draw()
 // for rendering capsules specifically we need a few more vertices
 #define MAX_POLYGON_VERTICES (B2_MAX_POLYGON_VERTICES + 2)
 
+// NOTE: these only append to the debug draw buffer of itu_lib_render, nothing is actually drawn
+//       until `itu_lib_render_debug_flush` is called
 void fn_box2d_wrapper_draw_polygon(b2Transform transform, const b2Vec2* vertices, int vertexCount, float radius, b2HexColor color, void* context)
 {
 	SDLContext* sdl_context = (SDLContext*)context;
 
-	float r = (float)((color & 0xFF0000) >> 16) / 255.0f;
-	float g = (float)((color & 0x00FF00) >>  8) / 255.0f;
-	float b = (float)((color & 0x0000FF))       / 255.0f;
-	SDL_FColor color_fill = {r, g, b, 0.25f};
+	struct color color_outline;
+	color_outline.r = (float)((color & 0xFF0000) >> 16) / 255.0f;
+	color_outline.g = (float)((color & 0x00FF00) >>  8) / 255.0f;
+	color_outline.b = (float)((color & 0x0000FF))       / 255.0f;
+	color_outline.a = 1.0f;
+	struct color color_fill = color_outline;
+	color_fill.a = 0.25f;
 
-	SDL_FPoint vs_outline[MAX_POLYGON_VERTICES+1];
-	SDL_Vertex vs[MAX_POLYGON_VERTICES];
-	SDL_zeroa(vs);
-	
+	vec2f points[MAX_POLYGON_VERTICES];
 	for (int i = 0; i < vertexCount; ++i)
 	{
 		b2Vec2 pos_b2world = b2TransformPoint(transform, vertices[i]);
-		vec2f pos = point_global_to_screen(sdl_context, value_cast(vec2f, pos_b2world));
-
-		vs[i].color = color_fill;
-		vs[i].position.x = pos.x;
-		vs[i].position.y = pos.y;
-		vs[i].tex_coord.x = 0;
-		vs[i].tex_coord.y = 0;
-		vs_outline[i].x = vs[i].position.x;
-		vs_outline[i].y = vs[i].position.y;
+		points[i] = point_global_to_screen(sdl_context, value_cast(vec2f, pos_b2world));
 	}
-	vs_outline[vertexCount].x = vs_outline[0].x;
-	vs_outline[vertexCount].y = vs_outline[0].y;
 
-	int indices_count = (vertexCount - 2)*3;
-	int indices[MAX_POLYGON_VERTICES*3];
-	int c = 0;
-	for (int i = 2; i < vertexCount; ++i)
-	{
-		indices[c++] = 0;
-		indices[c++] = i - 1;
-		indices[c++] = i;
-	}
-
-	SDL_RenderGeometry(sdl_context->renderer, NULL, vs, vertexCount, indices, indices_count);
-	
-	SDL_SetRenderDrawColor(sdl_context->renderer, (color & 0xFF0000) >> 16, (color & 0x00FF00) >>  8, (color & 0x0000FF), 0xFF);
-	SDL_RenderLines(sdl_context->renderer, vs_outline, vertexCount+1);
+	itu_lib_render_debug_polygon(points, vertexCount, color_fill, color_outline);
 }
 
 void fn_box2d_wrapper_draw_circle(b2Transform transform, float radius, b2HexColor b2_color, void* context)
 {
-	float angle_increment = TAU / 8;
+	const vec2f* unit_circle = itu_lib_render_get_unit_circle(8);
 	b2Vec2 vertices[8];
 
 	for(int i = 0; i < 8; ++i)
 	{
-		float angle = angle_increment * i;
-		float px = radius * SDL_cos(angle);
-		float py = radius * SDL_sin(angle);
-
-		vertices[i].x = px;
-		vertices[i].y = py;
+		vertices[i].x = radius * unit_circle[i].x;
+		vertices[i].y = radius * unit_circle[i].y;
 	}
 
 	fn_box2d_wrapper_draw_polygon(transform, vertices, 8, radius, b2_color, context);
@@ -188,7 +174,7 @@ void fn_box2d_wrapper_draw_capsule(b2Vec2 p1, b2Vec2 p2, float radius, b2HexColo
 	// we are still segmenting the circle in 8 parts,
 	// but we need 2 extra vertices since we are de-facto "extruding" half the circle
 	int circle_splits = MAX_POLYGON_VERTICES - 2;
-	float angle_increment = TAU / circle_splits;
+	const vec2f* unit_circle = itu_lib_render_get_unit_circle(circle_splits);
 	b2Vec2 vertices[MAX_POLYGON_VERTICES];
 
 	b2Vec2 offset = p1;
@@ -197,12 +183,10 @@ void fn_box2d_wrapper_draw_capsule(b2Vec2 p1, b2Vec2 p2, float radius, b2HexColo
 	{
 		for(int i = 0; i < circle_splits/2+1; ++i)
 		{
-			float angle = angle_increment * (i + (circle_splits/2) * circle_section);
-			float px = radius * SDL_cos(angle);
-			float py = radius * SDL_sin(angle);
+			vec2f unit = unit_circle[(i + (circle_splits/2) * circle_section) % circle_splits];
 
-			vertices[c].x = px + offset.x;
-			vertices[c].y = py + offset.y;
+			vertices[c].x = radius * unit.x + offset.x;
+			vertices[c].y = radius * unit.y + offset.y;
 			++c;
 		}
 		offset = p2;
@@ -1,10 +0,0 @@
-// implementaiton
-
-
-
-#include <box2d/box2d.h>
-
-void foo()
-{
-	b2Transform_Ap
-}
\ No newline at end of file
@@ -1,54 +1,142 @@
-#include <SDL3/SDL.h>
+// transform hierarchy
+// - `Transform` is always local: relative to the parent if the entity has a `TransformParent`, relative to the world otherwise
+// - `TransformWorld` caches the final world transform (both decomposed and as a matrix), computed by `itu_system_transform_propagate()`
+// - only entities with both `Transform` and `TransformWorld` take part in the hierarchy. A parent missing either of them
+//   (or destroyed) makes its children behave as roots
+// - world transforms are recomputed only for dirty subtrees: entities whose `Transform` or `TransformWorld` was written with a
+//   mutable accessor (see `entity_get_data_mut()`), whose parent changed, or whose parent was recomputed
+//
+// NOTE: scale is not skewed by rotations (a parent non-uniform scale is applied along the child own axes), same as most 2D engines
+// NOTE: cycles are not supported. `itu_sys_transform_set_parent()` rejects them, and if one is created anyway (writing `TransformParent`
+//       directly) `itu_system_transform_propagate()` logs a warning and treats one entity of the cycle as a root
+
+#ifndef ITU_SYS_TRANSFORM_HPP
+#define ITU_SYS_TRANSFORM_HPP
 
-#include <itu_common.hpp>
+#ifndef ITU_UNITY_BUILD
 #include <itu_lib_engine.hpp>
+#include <itu_entity_storage.hpp>
+#endif
 
-#include <stb_ds.h>
+struct TransformParent
+{
+	ITU_EntityId parent;
+};
 
-struct ITU_EntityId
+struct TransformWorld
 {
-	Uint64 id;
-	Uint64 component_mask;
+	// 2x3 affine matrix, column major (the last column is the translation):
+	// | matrix[0] matrix[2] matrix[4] |
+	// | matrix[1] matrix[3] matrix[5] |
+	float matrix[6];
+
+	// same transform, decomposed (what sprites are rendered with)
+	Transform transform;
+
+	ITU_EntityId parent; // parent at the time of the last update, to notice re-parenting
+	int depth;           // 0 for roots
 };
 
+bool  itu_sys_transform_set_parent(ITU_EntityId id, ITU_EntityId parent);
+ITU_EntityId itu_sys_transform_get_parent(ITU_EntityId id);
+void  itu_sys_transform_compose(TransformWorld* out, TransformWorld* parent, Transform* local);
+vec2f itu_sys_transform_point(TransformWorld* world, vec2f point_local);
 
+#endif // ITU_SYS_TRANSFORM_HPP
 
-//vec2f itu_trasform_get_position(ITU_IdComponentTransform id);
-//vec2f itu_trasform_get_scale(ITU_IdComponentTransform id);
-//float itu_trasform_get_rotation(ITU_IdComponentTransform id);
-//
-//void itu_trasform_set_position(ITU_IdComponentTransform id, vec2f position);
-//void itu_trasform_set_scale(ITU_IdComponentTransform id, vec2f scale);
-//void itu_trasform_set_rotation(ITU_IdComponentTransform id, float rotation);
+#if (defined ITU_SYS_TRANSFORM_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
 
-struct ITU_ComponentTransformData
+// `ITU_ENTITY_ID_NULL` parent detaches the entity (the component is removed).
+// Returns false (and leaves the entity as it is) if `parent` is the entity itself or one of its descendants
+// NOTE: the local `Transform` is left untouched, so the entity jumps unless it is updated too
+bool itu_sys_transform_set_parent(ITU_EntityId id, ITU_EntityId parent)
 {
-	vec2f pos;
-	vec2f scale;
-	float rotation;
-};
+	if(!itu_entity_is_valid(parent))
+	{
+		if(entity_get_data(id, TransformParent))
+			itu_entity_component_remove(id, ITU_COMPONENT_TYPE_TransformParent);
+		return true;
+	}
 
-#define TRANSFORM_COUNT_MAX 1024
+	// walk up from the new parent, looking for the entity itself.
+	// NOTE: a cycle could already be there (`TransformParent` written directly), so every time the number of steps doubles
+	//       we remember where we are. Coming back to that entity means we went all the way around a cycle without finding ours
+	ITU_EntityId ancestor = parent;
+	ITU_EntityId checkpoint = ITU_ENTITY_ID_NULL;
+	int steps = 0;
+	int steps_max = 1;
+	while(itu_entity_is_valid(ancestor))
+	{
+		if(ancestor.handle == id.handle)
+		{
+			SDL_Log("WARNING transform parent rejected, it would create a cycle\n");
+			return false;
+		}
+		if(ancestor.handle == checkpoint.handle)
+			break;
 
-ITU_ComponentTransformData data[TRANSFORM_COUNT_MAX];
-ITU_EntityId entity_ids[TRANSFORM_COUNT_MAX];
-Uint64 data_loc[TRANSFORM_COUNT_MAX];
-int data_alive_count;
+		if(steps == steps_max)
+		{
+			checkpoint = ancestor;
+			steps_max *= 2;
+			steps = 0;
+		}
+		ancestor = itu_sys_transform_get_parent(ancestor);
+		++steps;
+	}
 
-void itu_entity_add_component(ITU_EntityId id, ITU_ComponentType component_type)
-{
-	SDL_assert(component_type < 64);
-	Uint64 component_bit = 1 << component_type;
-	if(id.component_mask & component_bit)
+	TransformParent* data = entity_get_data_mut(id, TransformParent);
+	if(data)
 	{
-		SDL_Log("WARNING entity %lld alread has component type %d\n", id.id, component_type);
-		return;
+		data->parent = parent;
+		return true;
 	}
 
+	TransformParent transform_parent;
+	transform_parent.parent = parent;
+	entity_add_component(id, TransformParent, transform_parent);
+	return true;
+}
 
+ITU_EntityId itu_sys_transform_get_parent(ITU_EntityId id)
+{
+	ITU_EntityId ret = ITU_ENTITY_ID_NULL;
+	TransformParent* data = entity_get_data(id, TransformParent);
+	if(data)
+		ret = data->parent;
+	return ret;
 }
 
+// `parent` NULL means `local` is relative to the world
+void itu_sys_transform_compose(TransformWorld* out, TransformWorld* parent, Transform* local)
+{
+	if(parent)
+	{
+		Transform* p = &parent->transform;
+		out->transform.position = p->position + rotate(mul_element_wise(p->scale, local->position), p->rotation);
+		out->transform.scale    = mul_element_wise(p->scale, local->scale);
+		out->transform.rotation = p->rotation + local->rotation;
+	}
+	else
+		out->transform = *local;
+
+	float sin_r = SDL_sinf(out->transform.rotation);
+	float cos_r = SDL_cosf(out->transform.rotation);
+	out->matrix[0] =  cos_r * out->transform.scale.x;
+	out->matrix[1] =  sin_r * out->transform.scale.x;
+	out->matrix[2] = -sin_r * out->transform.scale.y;
+	out->matrix[3] =  cos_r * out->transform.scale.y;
+	out->matrix[4] = out->transform.position.x;
+	out->matrix[5] = out->transform.position.y;
+}
 
-//struct { ITU_EntityId key; Uint64 value; }* data_;
+// transforms a point from the local space of the entity to world space
+vec2f itu_sys_transform_point(TransformWorld* world, vec2f point_local)
+{
+	vec2f ret;
+	ret.x = world->matrix[0] * point_local.x + world->matrix[2] * point_local.y + world->matrix[4];
+	ret.y = world->matrix[1] * point_local.x + world->matrix[3] * point_local.y + world->matrix[5];
+	return ret;
+}
 
-hmput
\ No newline at end of file
+#endif // (defined ITU_SYS_TRANSFORM_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
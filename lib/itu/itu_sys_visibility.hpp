@@ -0,0 +1,311 @@
+// sprite visibility
+// - world-space bounds of rendered sprites are kept in a uniform grid (hashed, so the world doesn't need a fixed size).
+//   Only entities whose `TransformWorld` or `Sprite` changed since the last update are moved around in it
+// - `itu_sys_visibility_compute()` collects the entities overlapping a camera looking only at the cells under it,
+//   so its cost depends on what's visible, not on how many sprites there are
+// - every camera gets its own list, so more cameras can be rendered in the same frame (see `itu_sys_visibility_render_sprites()`)
+//
+// NOTE: bounds are conservative (the circle around the sprite, whatever its rotation and pivot), so a few sprites just
+//       outside the camera can still make it into the list
+// NOTE: entities leave the grid when they lose `Sprite` or `TransformWorld` (see observers in `itu_sys_estorage_init()`),
+//       `itu_sys_estorage_clear_all_entities()` included
+// NOTE: main thread only
+
+#ifndef ITU_SYS_VISIBILITY_HPP
+#define ITU_SYS_VISIBILITY_HPP
+
+#ifndef ITU_UNITY_BUILD
+#include <itu_lib_engine.hpp>
+#include <itu_entity_storage.hpp>
+#include <itu_lib_sprite.hpp>
+#include <itu_sys_transform.hpp>
+#endif
+
+#define VISIBILITY_CELL_SIZE_DEFAULT 4.0f
+#define VISIBILITY_CAMERAS_MAX 8
+
+void itu_sys_visibility_set_cell_size(float cell_size);
+void itu_sys_visibility_clear();
+void itu_sys_visibility_update(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count);
+void itu_sys_visibility_remove(ITU_EntityId id);
+ITU_EntityId* itu_sys_visibility_compute(SDLContext* context, Camera* camera, int* out_count);
+void itu_sys_visibility_render_sprites(SDLContext* context, Camera* camera);
+
+#endif // ITU_SYS_VISIBILITY_HPP
+
+#if (defined ITU_SYS_VISIBILITY_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
+
+// where an entity is in the grid, indexed by entity index
+struct ITU_VisibilityEntry
+{
+	ITU_EntityId id;    // ITU_ENTITY_ID_NULL if the slot is not in the grid (`cells` is empty too)
+	SDL_FRect bounds;   // x and y are the bottom-left corner
+	SDL_Rect  cells;    // cells range covered by `bounds` (x and y are the first cell, w and h the number of cells)
+	Uint32 query_stamp; // last query that collected this entity (to skip it in the other cells it covers)
+};
+
+struct ITU_VisibilityCell
+{
+	stbds_arr(ITU_EntityId) entity_ids;
+};
+
+struct SysVisibility
+{
+	float cell_size;
+
+	stbds_arr(ITU_VisibilityEntry) entries;
+	stbds_arr(ITU_VisibilityCell)  cells;
+	stbds_hm(Uint64, int)          cells_lookup; // maps packed cell coordinates to location in `cells`
+
+	Uint32 query_stamp;
+
+	// one visibility list per camera
+	Camera* cameras[VISIBILITY_CAMERAS_MAX];
+	stbds_arr(ITU_EntityId) cameras_visible[VISIBILITY_CAMERAS_MAX];
+	int cameras_count;
+};
+
+SysVisibility sys_visibility_data;
+
+Uint64 itu_sys_visibility_cell_key(int x, int y)
+{
+	return ((Uint64)(Uint32)x << 32) | (Uint64)(Uint32)y;
+}
+
+// NOTE: cells are never freed (empty ones are cheap, and most likely will be used again)
+ITU_VisibilityCell* itu_sys_visibility_cell_get(int x, int y, bool create)
+{
+	Uint64 key = itu_sys_visibility_cell_key(x, y);
+	int idx = stbds_hmgeti(sys_visibility_data.cells_lookup, key);
+	if(idx != -1)
+		return &sys_visibility_data.cells[sys_visibility_data.cells_lookup[idx].value];
+
+	if(!create)
+		return NULL;
+
+	ITU_VisibilityCell cell = { 0 };
+	stbds_hmput(sys_visibility_data.cells_lookup, key, (int)stbds_arrlen(sys_visibility_data.cells));
+	stbds_arrput(sys_visibility_data.cells, cell);
+	return &stbds_arrlast(sys_visibility_data.cells);
+}
+
+SDL_Rect itu_sys_visibility_cells_range(SDL_FRect bounds)
+{
+	float cell_size_inv = 1.0f / sys_visibility_data.cell_size;
+
+	SDL_Rect ret;
+	ret.x = (int)SDL_floorf(bounds.x * cell_size_inv);
+	ret.y = (int)SDL_floorf(bounds.y * cell_size_inv);
+	ret.w = (int)SDL_floorf((bounds.x + bounds.w) * cell_size_inv) - ret.x + 1;
+	ret.h = (int)SDL_floorf((bounds.y + bounds.h) * cell_size_inv) - ret.y + 1;
+	return ret;
+}
+
+void itu_sys_visibility_entry_unlink(ITU_VisibilityEntry* entry)
+{
+	for(int y = entry->cells.y; y < entry->cells.y + entry->cells.h; ++y)
+	{
+		for(int x = entry->cells.x; x < entry->cells.x + entry->cells.w; ++x)
+		{
+			ITU_VisibilityCell* cell = itu_sys_visibility_cell_get(x, y, false);
+			SDL_assert(cell);
+
+			// NOTE: cells hold a handful of entities, a linear search is fine
+			int count = stbds_arrlen(cell->entity_ids);
+			for(int i = 0; i < count; ++i)
+			{
+				if(itu_entity_equals(cell->entity_ids[i], entry->id))
+				{
+					stbds_arrdelswap(cell->entity_ids, i);
+					break;
+				}
+			}
+		}
+	}
+}
+
+void itu_sys_visibility_entry_link(ITU_VisibilityEntry* entry)
+{
+	for(int y = entry->cells.y; y < entry->cells.y + entry->cells.h; ++y)
+		for(int x = entry->cells.x; x < entry->cells.x + entry->cells.w; ++x)
+			stbds_arrput(itu_sys_visibility_cell_get(x, y, true)->entity_ids, entry->id);
+}
+
+// conservative bounds: the circle around the sprite, so that rotating it doesn't change them
+SDL_FRect itu_sys_visibility_sprite_bounds(SDLContext* context, Sprite* sprite, Transform* transform)
+{
+	vec2f size = itu_lib_sprite_get_world_size(context, sprite, transform);
+	size.x *= SDL_fabsf(transform->scale.x);
+	size.y *= SDL_fabsf(transform->scale.y);
+
+	vec2f extent;
+	extent.x = SDL_max(sprite->pivot.x, 1 - sprite->pivot.x) * size.x;
+	extent.y = SDL_max(sprite->pivot.y, 1 - sprite->pivot.y) * size.y;
+	float radius = length(extent);
+
+	SDL_FRect ret;
+	ret.x = transform->position.x - radius;
+	ret.y = transform->position.y - radius;
+	ret.w = radius * 2;
+	ret.h = radius * 2;
+	return ret;
+}
+
+// changing the cell size rebuilds the grid from scratch (on the next update)
+void itu_sys_visibility_set_cell_size(float cell_size)
+{
+	SDL_assert(cell_size > 0);
+	itu_sys_visibility_clear();
+	sys_visibility_data.cell_size = cell_size;
+}
+
+void itu_sys_visibility_clear()
+{
+	stbds_arrsetlen(sys_visibility_data.entries, 0);
+	for(int i = 0; i < stbds_arrlen(sys_visibility_data.cells); ++i)
+		stbds_arrfree(sys_visibility_data.cells[i].entity_ids);
+	stbds_arrsetlen(sys_visibility_data.cells, 0);
+	stbds_hmfree(sys_visibility_data.cells_lookup);
+}
+
+// brings the grid up to date for entities with `TransformWorld` and `Sprite`.
+// NOTE: has to run inside a system (it only looks at components changed since the last time the system ran)
+void itu_sys_visibility_update(SDLContext* context, ITU_EntityId* entity_ids, int entity_ids_count)
+{
+	if(sys_visibility_data.cell_size == 0)
+		sys_visibility_data.cell_size = VISIBILITY_CELL_SIZE_DEFAULT;
+
+	Uint32 index_max = 0;
+	for(int i = 0; i < entity_ids_count; ++i)
+		index_max = SDL_max(index_max, entity_ids[i].index);
+
+	int entries_count = stbds_arrlen(sys_visibility_data.entries);
+	if((int)index_max >= entries_count)
+	{
+		ITU_EntityId id_null = ITU_ENTITY_ID_NULL;
+		stbds_arrsetlen(sys_visibility_data.entries, index_max + 1);
+		for(int i = entries_count; i <= (int)index_max; ++i)
+		{
+			SDL_zero(sys_visibility_data.entries[i]);
+			sys_visibility_data.entries[i].id = id_null;
+		}
+	}
+
+	ITU_View<TransformWorld, Sprite> view;
+	for(int i = 0; i < entity_ids_count; ++i)
+	{
+		ITU_EntityId id = entity_ids[i];
+		ITU_VisibilityEntry* entry = &sys_visibility_data.entries[id.index];
+
+		bool is_linked = itu_entity_equals(entry->id, id);
+		if(is_linked && !view.changed<TransformWorld>(id) && !view.changed<Sprite>(id))
+			continue;
+
+		SDL_FRect bounds = itu_sys_visibility_sprite_bounds(context, &view.get<Sprite>(id), &view.get<TransformWorld>(id).transform);
+		SDL_Rect cells = itu_sys_visibility_cells_range(bounds);
+		entry->bounds = bounds;
+
+		if(is_linked && SDL_memcmp(&cells, &entry->cells, sizeof(SDL_Rect)) == 0)
+			continue;
+
+		// NOTE: the slot can also hold an older entity with the same index, that missed its removal
+		if(entry->cells.w > 0)
+			itu_sys_visibility_entry_unlink(entry);
+
+		entry->id = id;
+		entry->cells = cells;
+		itu_sys_visibility_entry_link(entry);
+	}
+}
+
+void itu_sys_visibility_remove(ITU_EntityId id)
+{
+	if(id.index >= stbds_arrlen(sys_visibility_data.entries))
+		return;
+
+	ITU_VisibilityEntry* entry = &sys_visibility_data.entries[id.index];
+	if(!itu_entity_equals(entry->id, id))
+		return;
+
+	itu_sys_visibility_entry_unlink(entry);
+	ITU_EntityId id_null = ITU_ENTITY_ID_NULL;
+	entry->id = id_null;
+	SDL_zero(entry->cells);
+}
+
+// returns the entities whose bounds overlap the area seen by `camera`.
+// The list belongs to the camera, and stays valid until the next call for the same camera
+ITU_EntityId* itu_sys_visibility_compute(SDLContext* context, Camera* camera, int* out_count)
+{
+	int camera_idx = 0;
+	while(camera_idx < sys_visibility_data.cameras_count && sys_visibility_data.cameras[camera_idx] != camera)
+		++camera_idx;
+	if(camera_idx == sys_visibility_data.cameras_count)
+	{
+		SDL_assert(sys_visibility_data.cameras_count < VISIBILITY_CAMERAS_MAX);
+		sys_visibility_data.cameras[sys_visibility_data.cameras_count++] = camera;
+	}
+
+	stbds_arr(ITU_EntityId)* visible = &sys_visibility_data.cameras_visible[camera_idx];
+	stbds_arrsetlen(*visible, 0);
+
+	if(sys_visibility_data.cell_size == 0)
+	{
+		*out_count = 0;
+		return *visible;
+	}
+
+	SDL_FRect rect = camera_get_world_rect(context, camera);
+	SDL_Rect cells = itu_sys_visibility_cells_range(rect);
+	Uint32 stamp = ++sys_visibility_data.query_stamp;
+
+	for(int y = cells.y; y < cells.y + cells.h; ++y)
+	{
+		for(int x = cells.x; x < cells.x + cells.w; ++x)
+		{
+			ITU_VisibilityCell* cell = itu_sys_visibility_cell_get(x, y, false);
+			if(!cell)
+				continue;
+
+			int count = stbds_arrlen(cell->entity_ids);
+			for(int i = 0; i < count; ++i)
+			{
+				ITU_EntityId id = cell->entity_ids[i];
+				ITU_VisibilityEntry* entry = &sys_visibility_data.entries[id.index];
+				if(entry->query_stamp == stamp)
+					continue;
+				entry->query_stamp = stamp;
+
+				if(SDL_HasRectIntersectionFloat(&rect, &entry->bounds))
+					stbds_arrput(*visible, id);
+			}
+		}
+	}
+
+	*out_count = stbds_arrlen(*visible);
+	return *visible;
+}
+
+// renders (batched) all the sprites visible from `camera`, making it the active one
+// NOTE: entities that stopped being valid (ie, after clearing all entities) are skipped
+void itu_sys_visibility_render_sprites(SDLContext* context, Camera* camera)
+{
+	if(context->camera_active != camera)
+		camera_set_active(context, camera);
+
+	int count;
+	ITU_EntityId* entity_ids = itu_sys_visibility_compute(context, camera, &count);
+	for(int i = 0; i < count; ++i)
+	{
+		if(!itu_entity_is_valid(entity_ids[i]))
+			continue;
+
+		TransformWorld* transform_world = entity_get_data(entity_ids[i], TransformWorld);
+		Sprite* sprite = entity_get_data(entity_ids[i], Sprite);
+		if(transform_world && sprite)
+			itu_lib_sprite_batch_add(context, sprite, &transform_world->transform);
+	}
+	itu_lib_sprite_batch_flush(context);
+}
+
+#endif // (defined ITU_SYS_VISIBILITY_IMPLEMENTATION) || (defined ITU_UNITY_BUILD)
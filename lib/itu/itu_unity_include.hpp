@@ -20,16 +20,21 @@
 #include <box2d/box2d.h>
 
 #include <itu_common.hpp>
+#include <itu_lib_arena.hpp>
 #include <itu_lib_engine.hpp>
+#include <itu_lib_jobs.hpp>
 
 #include <itu_entity_storage.hpp>
 
 #include <itu_lib_render.hpp>
 #include <itu_lib_overlaps.hpp>
 #include <itu_lib_sprite.hpp>
+#include <itu_lib_tilemap.hpp>
 #include <itu_lib_imgui.hpp>
 // #include <itu_lib_box2d.hpp> // deprecated
 #include <itu_sys_physics.hpp>
+#include <itu_sys_transform.hpp>
+#include <itu_sys_visibility.hpp>
 
 #include <itu_lib_debug_ui.hpp>
 #include <itu_default_systems.cpp>